@@ -0,0 +1,430 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MemoryPool.hpp"
+
+// Size classes covering every request the workloads make
+static size_t blksz[7] = {16, 32, 64, 128, 256, 512, 1024};
+
+static constexpr size_t HEAP_BYTES = 64 << 20;
+static constexpr size_t DEFAULT_OPS = 200000;
+static constexpr size_t FIXED_REQUEST = 64;
+static constexpr size_t MIX_LIVE = 256;
+static constexpr size_t BURST_BLOCKS = 256;
+static constexpr size_t QUEUE_SIZE = 1024;
+
+static MemoryPool *s_pool = nullptr;
+
+/** @brief Allocator under test, served by the pool */
+struct PoolApi
+{
+  static constexpr const char *NAME = "pool";
+  static void *allocate(size_t n) { return s_pool->allocate(n); }
+  static void release(void *p) { s_pool->release(p); }
+};
+
+/** @brief Reference allocator, the C library malloc */
+struct MallocApi
+{
+  static constexpr const char *NAME = "malloc";
+  static void *allocate(size_t n) { return std::malloc(n); }
+  static void release(void *p) { std::free(p); }
+};
+
+/** @brief Latencies and counts recorded by one thread */
+struct Sample
+{
+  std::vector<uint32_t> m_latency;
+  size_t m_failures{0};
+};
+
+/** @brief Outcome of one workload run */
+struct Result
+{
+  std::string workload;
+  std::string allocator;
+  size_t threads;
+  size_t ops;
+  size_t failures;
+  double opsPerSec;
+  uint32_t p50;
+  uint32_t p99;
+  uint32_t p999;
+};
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Time a single allocator operation, recording its latency in ns
+ */
+template <typename Op>
+inline auto timed(Sample &s, Op op)
+{
+  auto start = Clock::now();
+  auto r = op();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start);
+  s.m_latency.push_back(static_cast<uint32_t>(ns.count()));
+  return r;
+}
+
+/**
+ * @brief Allocate a fixed size block and free it straight away
+ */
+template <typename Api>
+void latencyWorker(Sample &s, size_t ops, size_t seed)
+{
+  for (size_t i = 0; i < ops / 2; ++i)
+  {
+    void *p = timed(s, [] { return Api::allocate(FIXED_REQUEST); });
+    if (!p)
+    {
+      ++s.m_failures;
+      continue;
+    }
+    timed(s, [p] { Api::release(p); return 0; });
+  }
+}
+
+/**
+ * @brief Replace random entries of a live set with requests of random sizes,
+ * spread evenly over the size classes
+ */
+template <typename Api>
+void mixWorker(Sample &s, size_t ops, size_t seed)
+{
+  std::mt19937_64 rng(seed);
+  std::vector<void *> live(MIX_LIVE, nullptr);
+  for (size_t i = 0; i < ops / 2; ++i)
+  {
+    size_t slot = rng() % MIX_LIVE;
+    size_t k = rng() % (sizeof(blksz) / sizeof(size_t));
+    size_t n = blksz[k] / 2 + 1 + rng() % (blksz[k] / 2);
+    if (live[slot])
+    {
+      void *p = live[slot];
+      timed(s, [p] { Api::release(p); return 0; });
+    }
+    live[slot] = timed(s, [n] { return Api::allocate(n); });
+    s.m_failures += live[slot] ? 0 : 1;
+  }
+  for (auto p : live)
+  {
+    if (p)
+    {
+      Api::release(p);
+    }
+  }
+}
+
+/**
+ * @brief Fill a burst of fixed size blocks, then drain them all
+ */
+template <typename Api>
+void burstWorker(Sample &s, size_t ops, size_t seed)
+{
+  std::vector<void *> b;
+  b.reserve(BURST_BLOCKS);
+  for (size_t done = 0; done < ops; done += 2 * BURST_BLOCKS)
+  {
+    for (size_t i = 0; i < BURST_BLOCKS; ++i)
+    {
+      void *p = timed(s, [] { return Api::allocate(FIXED_REQUEST); });
+      if (p)
+      {
+        b.push_back(p);
+      }
+      else
+      {
+        ++s.m_failures;
+      }
+    }
+    for (auto p : b)
+    {
+      timed(s, [p] { Api::release(p); return 0; });
+    }
+    b.clear();
+  }
+}
+
+/** @brief Single producer, single consumer ring of blocks in flight */
+struct Queue
+{
+  alignas(64) std::atomic<size_t> m_head{0};
+  alignas(64) std::atomic<size_t> m_tail{0};
+  void *m_slot[QUEUE_SIZE];
+};
+
+/**
+ * @brief Allocate fixed size blocks and hand them to the paired consumer
+ */
+template <typename Api>
+void producer(Sample &s, Queue &q, size_t ops)
+{
+  for (size_t i = 0; i < ops; ++i)
+  {
+    void *p = timed(s, [] { return Api::allocate(FIXED_REQUEST); });
+    if (!p)
+    {
+      ++s.m_failures;
+    }
+    size_t tail = q.m_tail.load(std::memory_order_relaxed);
+    while (tail - q.m_head.load(std::memory_order_acquire) == QUEUE_SIZE)
+    {
+      std::this_thread::yield();
+    }
+    q.m_slot[tail % QUEUE_SIZE] = p;
+    q.m_tail.store(tail + 1, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Free every block handed over by the paired producer
+ */
+template <typename Api>
+void consumer(Sample &s, Queue &q, size_t ops)
+{
+  for (size_t i = 0; i < ops; ++i)
+  {
+    size_t head = q.m_head.load(std::memory_order_relaxed);
+    while (q.m_tail.load(std::memory_order_acquire) == head)
+    {
+      std::this_thread::yield();
+    }
+    void *p = q.m_slot[head % QUEUE_SIZE];
+    q.m_head.store(head + 1, std::memory_order_release);
+    if (p)
+    {
+      timed(s, [p] { Api::release(p); return 0; });
+    }
+  }
+}
+
+/**
+ * @brief Merge the samples of every thread into a result
+ */
+Result summarize(const char *workload,
+    const char *allocator,
+    size_t threads,
+    std::vector<Sample> &samples,
+    Clock::duration elapsed)
+{
+  std::vector<uint32_t> all;
+  size_t failures = 0;
+  for (auto &s : samples)
+  {
+    all.insert(all.end(), s.m_latency.begin(), s.m_latency.end());
+    failures += s.m_failures;
+  }
+
+  auto percentile = [&all](double q) -> uint32_t {
+    if (all.empty())
+    {
+      return 0;
+    }
+    auto nth = all.begin() + static_cast<size_t>(q * (all.size() - 1));
+    std::nth_element(all.begin(), nth, all.end());
+    return *nth;
+  };
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  Result r{workload, allocator, threads, all.size() + failures, failures, 0, 0,
+      0, 0};
+  r.opsPerSec = (seconds > 0) ? r.ops / seconds : 0;
+  r.p50 = percentile(0.50);
+  r.p99 = percentile(0.99);
+  r.p999 = percentile(0.999);
+  return r;
+}
+
+/**
+ * @brief Run a workload with every thread doing its own allocations and frees
+ */
+template <typename Api>
+Result runLocal(const char *workload,
+    void (*worker)(Sample &, size_t, size_t),
+    size_t threads,
+    size_t ops)
+{
+  std::vector<Sample> samples(threads);
+  for (auto &s : samples)
+  {
+    s.m_latency.reserve(ops);
+  }
+
+  std::vector<std::thread> t;
+  auto start = Clock::now();
+  for (size_t i = 0; i < threads; ++i)
+  {
+    t.emplace_back(worker, std::ref(samples[i]), ops, i + 1);
+  }
+  for (auto &th : t)
+  {
+    th.join();
+  }
+  return summarize(workload, Api::NAME, threads, samples,
+      Clock::now() - start);
+}
+
+/**
+ * @brief Run producer/consumer pairs, every block being freed by a different
+ * thread than the one allocating it
+ */
+template <typename Api>
+Result runCrossThread(size_t threads, size_t ops)
+{
+  size_t pairs = threads / 2;
+  std::vector<Sample> samples(threads);
+  std::vector<Queue> queues(pairs);
+  for (auto &s : samples)
+  {
+    s.m_latency.reserve(ops / 2);
+  }
+
+  std::vector<std::thread> t;
+  auto start = Clock::now();
+  for (size_t i = 0; i < pairs; ++i)
+  {
+    t.emplace_back(producer<Api>, std::ref(samples[2 * i]),
+        std::ref(queues[i]), ops / 2);
+    t.emplace_back(consumer<Api>, std::ref(samples[2 * i + 1]),
+        std::ref(queues[i]), ops / 2);
+  }
+  for (auto &th : t)
+  {
+    th.join();
+  }
+  return summarize("cross_thread", Api::NAME, threads, samples,
+      Clock::now() - start);
+}
+
+/**
+ * @brief Run every workload at one thread count against one allocator
+ */
+template <typename Api>
+void runAll(size_t threads, size_t ops, std::vector<Result> &results)
+{
+  results.push_back(runLocal<Api>("latency", latencyWorker<Api>, threads, ops));
+  if (threads >= 2)
+  {
+    results.push_back(runCrossThread<Api>(threads, ops));
+  }
+  results.push_back(runLocal<Api>("size_mix", mixWorker<Api>, threads, ops));
+  results.push_back(runLocal<Api>("burst", burstWorker<Api>, threads, ops));
+}
+
+void printResult(const Result &r)
+{
+  std::cout << std::setw(14) << r.workload << std::setw(8) << r.allocator
+            << std::setw(8) << r.threads << std::setw(14) << std::fixed
+            << std::setprecision(0) << r.opsPerSec << std::setw(8) << r.p50
+            << std::setw(8) << r.p99 << std::setw(9) << r.p999 << std::setw(10)
+            << r.failures << std::endl;
+}
+
+std::string toJson(const std::vector<Result> &results, size_t ops)
+{
+  std::ostringstream os;
+  os << "{\n  \"ops_per_thread\": " << ops << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    auto &r = results[i];
+    os << (i ? ",\n" : "\n") << "    {\"workload\": \"" << r.workload
+       << "\", \"allocator\": \"" << r.allocator
+       << "\", \"threads\": " << r.threads << ", \"ops\": " << r.ops
+       << ", \"failures\": " << r.failures << ", \"ops_per_sec\": "
+       << std::fixed << std::setprecision(0) << r.opsPerSec
+       << ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99
+       << ", \"p999_ns\": " << r.p999 << "}";
+  }
+  os << "\n  ]\n}\n";
+  return os.str();
+}
+
+/**
+ * Usage: bench [--threads N] [--ops N] [--json FILE]
+ *
+ * Runs every workload at 1, 2, 4, ... N threads (default: the number of
+ * hardware threads, at least 2) against the pool and malloc, printing a table
+ * and optionally writing the results as JSON.
+ */
+int main(int argc, char *argv[])
+{
+  size_t maxThreads = std::max(2u, std::thread::hardware_concurrency());
+  size_t ops = DEFAULT_OPS;
+  const char *json = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (0 == strcmp(argv[i], "--threads"))
+    {
+      maxThreads = std::max(1ul, strtoul(argv[i + 1], nullptr, 10));
+    }
+    else if (0 == strcmp(argv[i], "--ops"))
+    {
+      ops = std::max(2 * BURST_BLOCKS, strtoul(argv[i + 1], nullptr, 10));
+    }
+    else if (0 == strcmp(argv[i], "--json"))
+    {
+      json = argv[i + 1];
+    }
+    else
+    {
+      std::cerr << " !! Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = sizeof(blksz) / sizeof(size_t);
+  config.heapBytes = HEAP_BYTES;
+  MemoryPool pool(config);
+  if (!pool.isInitialized())
+  {
+    std::cerr << " !! Failed to create the benchmark pool" << std::endl;
+    return 1;
+  }
+  s_pool = &pool;
+
+  std::cout << std::setw(14) << "workload" << std::setw(8) << "alloc"
+            << std::setw(8) << "threads" << std::setw(14) << "ops/sec"
+            << std::setw(8) << "p50 ns" << std::setw(8) << "p99 ns"
+            << std::setw(9) << "p99.9 ns" << std::setw(10) << "failures"
+            << std::endl;
+
+  std::vector<Result> results;
+  for (size_t threads = 1; threads <= maxThreads;
+       threads = (threads < maxThreads) ? std::min(2 * threads, maxThreads)
+                                        : threads + 1)
+  {
+    size_t first = results.size();
+    runAll<PoolApi>(threads, ops, results);
+    runAll<MallocApi>(threads, ops, results);
+    for (size_t i = first; i < results.size(); ++i)
+    {
+      printResult(results[i]);
+    }
+  }
+
+  if (json)
+  {
+    std::ofstream out(json);
+    out << toJson(results, ops);
+    if (!out)
+    {
+      std::cerr << " !! Failed to write " << json << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "MemoryPool.hpp"
+
+static constexpr size_t N_REQUESTS = 20000;
+static constexpr size_t MIN_REQUEST = 16;
+static constexpr size_t MAX_REQUEST = 4096;
+
+/**
+ * @brief Serve the whole workload from a pool with the given block sizes,
+ * budgeted with exactly the blocks the workload needs, and report the heap
+ * required
+ */
+bool run(const char *name,
+    const std::vector<size_t> &sizes,
+    const std::vector<size_t> &requests)
+{
+  // Count the blocks needed of each size; unused sizes keep a single block
+  std::vector<size_t> counts(sizes.size(), 0);
+  size_t requested = 0;
+  for (auto n : requests)
+  {
+    size_t i = 0;
+    while (sizes[i] < n)
+    {
+      ++i;
+    }
+    ++counts[i];
+    requested += n;
+  }
+  for (auto &c : counts)
+  {
+    c = c ? c : 1;
+  }
+
+  PoolConfig config;
+  config.blockSizes = sizes.data();
+  config.nSizes = sizes.size();
+  config.blockCounts = counts.data();
+  MemoryPool pool(config);
+
+  size_t served = 0;
+  for (auto n : requests)
+  {
+    served += pool.allocate(n) ? 1 : 0;
+  }
+  if (!pool.isInitialized() || (served != requests.size()))
+  {
+    std::cout << " !! " << name << ": served " << served << " of "
+              << requests.size() << " requests" << std::endl;
+    return false;
+  }
+
+  size_t heap = pool.getHeapSize();
+  std::cout << std::setw(14) << name << std::setw(8) << sizes.size()
+            << std::setw(12) << requested << std::setw(12) << heap
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << 100.0 * (heap - requested) / heap << std::endl;
+  return true;
+}
+
+int main()
+{
+  // Request sizes spread evenly over each doubling (log-uniform), with a fixed
+  // seed so runs are comparable
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> exponent(
+      std::log2(MIN_REQUEST), std::log2(MAX_REQUEST));
+  std::vector<size_t> requests;
+  for (size_t i = 0; i < N_REQUESTS; ++i)
+  {
+    requests.emplace_back(static_cast<size_t>(std::exp2(exponent(rng))));
+  }
+
+  // Power of 2 block sizes against four size classes per doubling, both
+  // covering the same range
+  std::vector<size_t> pow2;
+  std::vector<size_t> quarter;
+  for (size_t s = MIN_REQUEST; s <= MAX_REQUEST; s *= 2)
+  {
+    pow2.emplace_back(s);
+    quarter.emplace_back(s);
+    for (size_t step = 5; (step < 8) && (s < MAX_REQUEST); ++step)
+    {
+      // Steps that are not a multiple of 16 are not size classes
+      size_t c = s * step / 4;
+      if (0 == (c % 16))
+      {
+        quarter.emplace_back(c);
+      }
+    }
+  }
+
+  std::cout << " ** Internal fragmentation for " << N_REQUESTS
+            << " live requests of " << MIN_REQUEST << " to " << MAX_REQUEST
+            << " bytes" << std::endl;
+  std::cout << std::setw(14) << "classes" << std::setw(8) << "sizes"
+            << std::setw(12) << "requested" << std::setw(12) << "heap"
+            << std::setw(10) << "waste %" << std::endl;
+
+  bool ok = run("power of 2", pow2, requests);
+  ok = run("quarter step", quarter, requests) && ok;
+  return !ok;
+}
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "MemoryPool.hpp"
+
+// A single size class gives the largest possible free list for one allocator
+static size_t blksz[1] = {64};
+
+static constexpr size_t N_REPEAT = 200;
+
+int main()
+{
+  auto &pool = MemoryPool::getPool(blksz, sizeof(blksz) / sizeof(size_t));
+
+  // Send every release straight to the shared allocator so the measurement
+  // covers the double-release check rather than the thread cache
+  pool.setCacheDepth(0);
+
+  // Count the blocks available in the pool
+  std::vector<void *> b;
+  void *block = nullptr;
+  while ((block = pool.allocate(blksz[0])))
+  {
+    b.emplace_back(block);
+  }
+  for (auto p : b)
+  {
+    pool.release(p);
+  }
+  const size_t nBlocks = b.size();
+  b.clear();
+
+  std::cout << " ** Free latency for " << nBlocks << " blocks of size "
+            << blksz[0] << std::endl;
+  std::cout << std::setw(8) << "fill %" << std::setw(12) << "free ns"
+            << std::endl;
+
+  for (size_t fill = 0; fill <= 100; fill += 10)
+  {
+    // Hold the pool at the requested fill level, plus the block being timed
+    size_t held = (nBlocks - 1) * fill / 100;
+    for (size_t i = 0; i < held; ++i)
+    {
+      b.emplace_back(pool.allocate(blksz[0]));
+    }
+
+    std::chrono::nanoseconds total{0};
+    for (size_t r = 0; r < N_REPEAT; ++r)
+    {
+      void *p = pool.allocate(blksz[0]);
+      auto start = std::chrono::steady_clock::now();
+      pool.release(p);
+      total += std::chrono::steady_clock::now() - start;
+    }
+
+    std::cout << std::setw(8) << fill << std::setw(12)
+              << total.count() / N_REPEAT << std::endl;
+
+    for (auto p : b)
+    {
+      pool.release(p);
+    }
+    b.clear();
+  }
+}
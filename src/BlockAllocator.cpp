@@ -1,165 +1,840 @@
 #include "BlockAllocator.hpp"
 
+#include <sys/mman.h>
+
 #ifdef DEBUG
 #include <iostream>
 #endif
 
 BlockAllocator::BlockAllocator(size_t blockSize,
-    uint32_t numBytes,
-    MemoryBlock *p)
-    : m_blockSize(blockSize), m_numBlocks(numBytes / blockSize), m_freeBlock(p)
+    size_t numBytes,
+    MemoryBlock *p,
+    std::atomic<uint64_t> *state)
+    : m_blockSize(blockSize), m_blockShift(__builtin_ctzll(blockSize)),
+      m_blockInverse(oddInverse(blockSize >> __builtin_ctzll(blockSize))),
+      m_numBlocks(numBytes / blockSize), m_startBlock(p), m_state(state),
+      m_loose(state + (m_numBlocks + STATE_BITS - 1) / STATE_BITS),
+      m_trimmedPages(m_loose + (m_numBlocks + STATE_BITS - 1) / STATE_BITS)
 {
 #ifdef DEBUG
-  std::cout << " ** Allocator[" << m_blockSize << "] @ " << m_freeBlock
+  std::cout << " ** Allocator[" << m_blockSize << "] @ " << m_startBlock
             << " with " << m_numBlocks << " blocks" << std::endl;
 #endif
 
-  auto block = m_freeBlock;
-  m_startBlock = m_freeBlock;
-#ifdef DEBUG
-  std::cout << "\tBlock address: " << block << std::endl;
-#endif
-  for (uint32_t i = 1; i < m_numBlocks; ++i)
-  {
-    block->m_next = block + m_blockSize / sizeof(block);
-    block = block->m_next;
-#ifdef DEBUG
-    std::cout << "\tBlock address: " << block << std::endl;
-#endif
-  }
-#ifdef DEBUG
-  std::cout << std::endl;
-#endif
-
-  // Ensure final block has next block set to nullptr
-  block->m_next = nullptr;
+  // The whole space starts out uncarved and the free list empty; nothing in
+  // the space is written until its blocks are first handed out
+  m_freeHead.store(pack(nullptr, 0), std::memory_order_release);
+  m_carved.store(0, std::memory_order_release);
 }
 
 BlockAllocator::BlockAllocator(const BlockAllocator &ma)
 {
   m_blockSize = ma.m_blockSize;
+  m_blockShift = ma.m_blockShift;
+  m_blockInverse = ma.m_blockInverse;
   m_numBlocks = ma.m_numBlocks;
-  m_freeBlock = ma.m_freeBlock;
   m_startBlock = ma.m_startBlock;
+  m_state = ma.m_state;
+  m_loose = ma.m_loose;
+  m_trimmedPages = ma.m_trimmedPages;
+  m_freeHead.store(ma.m_freeHead.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_remoteHead.store(ma.m_remoteHead.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_carved.store(ma.m_carved.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_looseCount.store(ma.m_looseCount.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_looseHint.store(ma.m_looseHint.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_trimPage.store(ma.m_trimPage.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_contention.store(ma.m_contention.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_taken.store(ma.m_taken.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_highWater.store(ma.m_highWater.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_released.store(ma.m_released.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
 }
 
 BlockAllocator &BlockAllocator::operator=(const BlockAllocator &ma)
 {
   m_blockSize = ma.m_blockSize;
+  m_blockShift = ma.m_blockShift;
+  m_blockInverse = ma.m_blockInverse;
   m_numBlocks = ma.m_numBlocks;
-  m_freeBlock = ma.m_freeBlock;
   m_startBlock = ma.m_startBlock;
+  m_state = ma.m_state;
+  m_loose = ma.m_loose;
+  m_trimmedPages = ma.m_trimmedPages;
+  m_freeHead.store(ma.m_freeHead.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_remoteHead.store(ma.m_remoteHead.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_carved.store(ma.m_carved.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_looseCount.store(ma.m_looseCount.load(std::memory_order_acquire),
+      std::memory_order_release);
+  m_looseHint.store(ma.m_looseHint.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_trimPage.store(ma.m_trimPage.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_contention.store(ma.m_contention.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_taken.store(ma.m_taken.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_highWater.store(ma.m_highWater.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  m_released.store(ma.m_released.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
 
   return *this;
 }
 
 MemoryBlock *BlockAllocator::allocateBlock()
 {
-  // Scoped lock to protect updates to block pointer
-  std::lock_guard<std::mutex> lk(m_lock);
+  size_t count;
+  auto block = allocateChain(1, count);
+  if (block)
+  {
+    setAllocated(block);
+  }
+  return block;
+}
+
+bool BlockAllocator::releaseBlock(void *p)
+{
+  // Clearing the state bit rejects anything that is not an in-use block of
+  // this allocator, including a block that is already free (i.e. someone is
+  // double-calling release)
+  if (!clearAllocated(p))
+  {
+    return false;
+  }
 
-  // Save the current block for allocation off to return (can be nullptr)
-  auto p = m_freeBlock;
+  // Link the released block to the beginning of the list
+  MemoryBlock *block = reinterpret_cast<MemoryBlock *>(p);
+  releaseChain(block, block, 1);
 
-  // Move the block pointer to the next block if not nullptr
-  if (m_freeBlock)
+#ifdef DEBUG
+  std::cout << " ** Freed block @ " << p << " back to allocator of size "
+            << m_blockSize << std::endl;
+  showFree();
+#endif
+
+  return true;
+}
+
+size_t BlockAllocator::allocateBulk(size_t n, void **out)
+{
+  size_t count;
+  auto block = allocateChain(n, count);
+  for (size_t i = 0; i < count; ++i)
   {
-    m_freeBlock = m_freeBlock->m_next;
+    out[i] = block;
+    setAllocated(block);
+    block = block->m_next;
+  }
+  return count;
+}
+
+size_t BlockAllocator::releaseBulk(void **p, size_t n)
+{
+  // Link the released blocks into a private chain, then splice it onto the
+  // free list in one go
+  MemoryBlock *head = nullptr;
+  MemoryBlock *tail = nullptr;
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (clearAllocated(p[i]))
+    {
+      auto block = reinterpret_cast<MemoryBlock *>(p[i]);
+      block->m_next = head;
+      tail = head ? tail : block;
+      head = block;
+      ++count;
+    }
   }
 
-  return p;
+  if (head)
+  {
+    releaseChain(head, tail, count);
+  }
+  return count;
 }
 
-bool BlockAllocator::releaseBlock(void *p)
+void BlockAllocator::setAllocated(MemoryBlock *block)
 {
-  bool released = false;
+  size_t i = ((reinterpret_cast<uint8_t *>(block) -
+                  reinterpret_cast<uint8_t *>(m_startBlock)) >>
+                 m_blockShift) *
+             m_blockInverse;
+  m_state[i / STATE_BITS].fetch_or(uint64_t(1) << (i % STATE_BITS),
+      std::memory_order_relaxed);
+}
 
-  // Check for a block that we already think is free (i.e. someone is
-  // double-calling release)
-  if (inChain(p))
+bool BlockAllocator::clearAllocated(void *p)
+{
+  size_t i;
+  if (!blockIndex(p, i))
+  {
+    return false;
+  }
+
+  // Exactly one release of an in-use block sees its bit set
+  uint64_t bit = uint64_t(1) << (i % STATE_BITS);
+  uint64_t old =
+      m_state[i / STATE_BITS].fetch_and(~bit, std::memory_order_relaxed);
+  return 0 != (old & bit);
+}
+
+bool BlockAllocator::isAllocated(void *p)
+{
+  size_t i;
+  if (!blockIndex(p, i))
+  {
+    return false;
+  }
+
+  uint64_t bit = uint64_t(1) << (i % STATE_BITS);
+  return 0 != (m_state[i / STATE_BITS].load(std::memory_order_relaxed) & bit);
+}
+
+MemoryBlock *BlockAllocator::allocateChain(size_t n,
+    size_t &count,
+    bool &carved)
+{
+  count = 0;
+  carved = false;
+  if (0 == n)
   {
-    released = true;
+    return nullptr;
   }
-  else
+
+  uint64_t head = m_freeHead.load(std::memory_order_acquire);
+  while (true)
   {
-    // Calculate whether the provided address falls within the allocator space
-    size_t diff = reinterpret_cast<uint8_t *>(p) -
-                  reinterpret_cast<uint8_t *>(m_startBlock);
-#if defined(DEBUG) && 0
-    std::cout << "p: " << p << std::endl;
-    std::cout << "a: " << m_startBlock << std::endl;
-    std::cout << "p - allocator[i].start = " << diff << " < "
-              << (m_blockSize * m_numBlocks) << std::endl;
+    // Released blocks are reused first, while they are still warm in the
+    // cache; once the free list runs dry, everything released since the last
+    // miss is reclaimed in one go before any loose or fresh block is claimed
+    auto first = unpack(head);
+    if (!first)
+    {
+      if (!reclaimRemote(head))
+      {
+        auto chain = claimLoose(n, count);
+        if (!chain)
+        {
+          chain = carveChain(n, count);
+          carved = (nullptr != chain);
+        }
+        if (chain)
+        {
+          countTaken(count);
+        }
+        return chain;
+      }
+      head = m_freeHead.load(std::memory_order_acquire);
+      continue;
+    }
+
+    // Walk at most n blocks down the list to find the end of the chain. The
+    // links are read optimistically: if any other thread pops or pushes in the
+    // meantime the tag changes and the exchange below fails, so a stale or
+    // user-overwritten link is only ever validated, never trusted.
+    auto tail = first;
+    size_t walked = 1;
+    bool consistent = true;
+    while (walked < n)
+    {
+      auto next = tail->m_next;
+      if (!next)
+      {
+        break;
+      }
+      if (!isBlock(next))
+      {
+        consistent = false;
+        break;
+      }
+      tail = next;
+      ++walked;
+    }
+
+    if (!consistent)
+    {
+      m_contention.fetch_add(1, std::memory_order_relaxed);
+      head = m_freeHead.load(std::memory_order_acquire);
+      continue;
+    }
+
+    // Detach the chain from the remainder of the free list
+    if (m_freeHead.compare_exchange_weak(head, pack(tail->m_next, head),
+            std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      tail->m_next = nullptr;
+      count = walked;
+      countTaken(count);
+      return first;
+    }
+
+    // Another thread changed the list first
+    m_contention.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void BlockAllocator::countTaken(size_t count)
+{
+  // Blocks are only released after being taken, but releases of blocks taken
+  // by other threads since may already show, so the difference is clamped.
+  // The mark is only exchanged while the allocator fills.
+  uint64_t taken = m_taken.fetch_add(count, std::memory_order_relaxed) + count;
+  uint64_t released = m_released.load(std::memory_order_relaxed);
+  uint64_t out = (taken > released) ? taken - released : 0;
+  uint64_t high = m_highWater.load(std::memory_order_relaxed);
+  while ((out > high) && !m_highWater.compare_exchange_weak(high, out,
+                             std::memory_order_relaxed))
+  {
+  }
+}
+
+MemoryBlock *BlockAllocator::carveChain(size_t n, size_t &count)
+{
+  // Claim up to n blocks off the front of the uncarved space
+  size_t carved = m_carved.load(std::memory_order_relaxed);
+  size_t take = 0;
+  while (true)
+  {
+    if (carved >= m_numBlocks)
+    {
+      return nullptr;
+    }
+    take = (m_numBlocks - carved < n) ? m_numBlocks - carved : n;
+    if (m_carved.compare_exchange_weak(carved, carved + take,
+            std::memory_order_relaxed, std::memory_order_relaxed))
+    {
+      break;
+    }
+
+    // Another thread carved first
+    m_contention.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  auto first = linkBlocks(carved, take);
+#ifdef DEBUG
+  std::cout << " ** Carved " << take << " blocks of size " << m_blockSize
+            << " @ " << first << std::endl;
 #endif
+  count = take;
+  return first;
+}
 
-    // Check that the provided address is inside the memory block of the
-    // allocator
-    if ((p >= m_startBlock) && (diff < (m_blockSize * m_numBlocks)))
+MemoryBlock *BlockAllocator::claimLoose(size_t n, size_t &count)
+{
+  if (!m_looseCount.load(std::memory_order_acquire))
+  {
+    return nullptr;
+  }
+
+  // Scan from the word last claimed from, once round the bitmap for blocks
+  // clear of trimmed pages, which are only faulted back in when no other
+  // loose block is left
+  const size_t words = (m_numBlocks + STATE_BITS - 1) / STATE_BITS;
+  const size_t hint = m_looseHint.load(std::memory_order_relaxed);
+  for (size_t k = 0; k < 2 * words; ++k)
+  {
+    size_t w = (hint + k) % words;
+    uint64_t bits = m_loose[w].load(std::memory_order_relaxed);
+    size_t end = ((w + 1) * STATE_BITS < m_numBlocks) ? (w + 1) * STATE_BITS
+                                                      : m_numBlocks;
+    if (bits && (k < words) && pagesTrimmed(w * STATE_BITS, end))
     {
-      released = true;
-      MemoryBlock *block = reinterpret_cast<MemoryBlock *>(p);
+      continue;
+    }
+    while (bits)
+    {
+      // Claim the lowest n loose blocks of the word
+      uint64_t claim = 0;
+      uint64_t rest = bits;
+      for (size_t taken = 0; rest && (taken < n); ++taken)
+      {
+        claim |= rest & (~rest + 1);
+        rest &= rest - 1;
+      }
+      if (!m_loose[w].compare_exchange_weak(bits, bits & ~claim,
+              std::memory_order_acquire, std::memory_order_relaxed))
+      {
+        // Another thread claimed first
+        m_contention.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      count = __builtin_popcountll(claim);
+      m_looseCount.fetch_sub(count, std::memory_order_relaxed);
+      m_looseHint.store(w, std::memory_order_relaxed);
 
-      // Scoped lock to protect updates to block pointer
-      std::lock_guard<std::mutex> lk(m_lock);
-      // Link the released block to the beginning of the list
-      block->m_next = m_freeBlock;
-      // Set the next block pointer at the recently released block
-      m_freeBlock = block;
+      // Blocks between the claimed ones are not loose, so no page they share
+      // with them is still trimmed
+      size_t low = w * STATE_BITS + __builtin_ctzll(claim);
+      size_t high = w * STATE_BITS + (STATE_BITS - __builtin_clzll(claim));
+      untrimPages(low, high);
 
+      const size_t stride = m_blockSize / sizeof(MemoryBlock);
+      MemoryBlock *head = nullptr;
+      for (size_t i = high; i-- > low;)
+      {
+        if (claim & (uint64_t(1) << (i % STATE_BITS)))
+        {
+          auto block = m_startBlock + i * stride;
+          block->m_next = head;
+          head = block;
+        }
+      }
 #ifdef DEBUG
-      std::cout << " ** Freed block @ " << p << " back to allocator of size "
+      std::cout << " ** Reused " << count << " loose blocks of size "
                 << m_blockSize << std::endl;
-      showFree();
 #endif
+      return head;
     }
   }
+  return nullptr;
+}
 
-  return released;
+void BlockAllocator::setLoose(MemoryBlock *block)
+{
+  // The count is raised first, so it never falls below the loose blocks
+  size_t i;
+  blockIndex(block, i);
+  m_looseCount.fetch_add(1, std::memory_order_relaxed);
+  m_loose[i / STATE_BITS].fetch_or(uint64_t(1) << (i % STATE_BITS),
+      std::memory_order_release);
+}
+
+bool BlockAllocator::holdLoose(size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end;)
+  {
+    size_t w = i / STATE_BITS;
+    size_t stop = ((w + 1) * STATE_BITS < end) ? (w + 1) * STATE_BITS : end;
+    uint64_t mask = bitRange(i % STATE_BITS, stop - w * STATE_BITS);
+    uint64_t old = m_loose[w].fetch_and(~mask, std::memory_order_acquire);
+    if ((old & mask) != mask)
+    {
+      // Hand back what was taken
+      m_loose[w].fetch_or(old & mask, std::memory_order_release);
+      unholdLoose(begin, i);
+      return false;
+    }
+    i = stop;
+  }
+  return true;
 }
 
-bool BlockAllocator::inChain(void *p)
+void BlockAllocator::unholdLoose(size_t begin, size_t end)
 {
-  bool present = false;
+  for (size_t i = begin; i < end;)
+  {
+    size_t w = i / STATE_BITS;
+    size_t stop = ((w + 1) * STATE_BITS < end) ? (w + 1) * STATE_BITS : end;
+    m_loose[w].fetch_or(bitRange(i % STATE_BITS, stop - w * STATE_BITS),
+        std::memory_order_release);
+    i = stop;
+  }
+}
 
-  auto block = m_freeBlock;
-  while (block)
+MemoryBlock *BlockAllocator::linkBlocks(size_t first, size_t count)
+{
+  // The claimed blocks belong to this thread alone, so they are linked with
+  // plain stores, faulting in only the pages they occupy
+  const size_t stride = m_blockSize / sizeof(MemoryBlock);
+  auto head = m_startBlock + first * stride;
+  auto block = head;
+  for (size_t i = 1; i < count; ++i)
   {
+    block->m_next = block + stride;
+    block = block->m_next;
+  }
+  block->m_next = nullptr;
+  return head;
+}
+
+size_t BlockAllocator::trim(size_t pageBytes, int advice)
+{
+  if ((pageBytes < TRIM_PAGE_MIN) ||
+      m_trimming.exchange(true, std::memory_order_acquire))
+  {
+    return 0;
+  }
+  m_trimPage.store(pageBytes, std::memory_order_relaxed);
+
+  // Move the free blocks to the loose bitmap one at a time, so at most one is
+  // out of reach of allocations at any moment. Blocks released meanwhile are
+  // reclaimed too, up to the number of blocks in the allocator.
+  uint64_t head = m_freeHead.load(std::memory_order_acquire);
+  for (size_t moved = 0; moved < m_numBlocks;)
+  {
+    auto block = unpack(head);
+    if (!block)
+    {
+      if (!reclaimRemote(head))
+      {
+        break;
+      }
+      head = m_freeHead.load(std::memory_order_acquire);
+      continue;
+    }
+
+    // The link is validated as in allocateChain(), the tag making sure it was
+    // not overwritten by a new owner
+    auto next = block->m_next;
+    if ((next && !isBlock(next)) ||
+        !m_freeHead.compare_exchange_weak(head, pack(next, head),
+            std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      m_contention.fetch_add(1, std::memory_order_relaxed);
+      head = m_freeHead.load(std::memory_order_acquire);
+      continue;
+    }
+    setLoose(block);
+    ++moved;
+  }
+
+  // Advise away the whole pages inside each run of loose blocks, a chunk at a
+  // time, skipping pages still trimmed from an earlier call
+  const uintptr_t start = reinterpret_cast<uintptr_t>(m_startBlock);
+  const uintptr_t base = (start + pageBytes - 1) & ~(pageBytes - 1);
+  const size_t carved = m_carved.load(std::memory_order_acquire);
+  auto loose = [this](size_t i) {
+    return 0 != (m_loose[i / STATE_BITS].load(std::memory_order_relaxed) &
+                    (uint64_t(1) << (i % STATE_BITS)));
+  };
+  size_t bytes = 0;
+  for (size_t a = 0; a < carved;)
+  {
+    if (!m_loose[a / STATE_BITS].load(std::memory_order_relaxed))
+    {
+      a = (a / STATE_BITS + 1) * STATE_BITS;
+      continue;
+    }
+    if (!loose(a))
+    {
+      ++a;
+      continue;
+    }
+    size_t b = a + 1;
+    while ((b < carved) && loose(b))
+    {
+      ++b;
+    }
+
+    uintptr_t from = start + a * m_blockSize;
+    uintptr_t to = start + b * m_blockSize;
+    size_t first =
+        (from > base) ? (from - base + pageBytes - 1) / pageBytes : 0;
+    size_t last = (to > base) ? (to - base) / pageBytes : 0;
+    size_t chunk = first;
+    for (size_t j = first; j <= last; ++j)
+    {
+      bool trimmed = (j < last) &&
+                     (m_trimmedPages[j / STATE_BITS].load(
+                          std::memory_order_relaxed) &
+                         (uint64_t(1) << (j % STATE_BITS)));
+      if ((j == last) || trimmed || (j - chunk == TRIM_CHUNK))
+      {
+        if (j > chunk)
+        {
+          bytes += trimPages(chunk, j, pageBytes, advice);
+        }
+        chunk = trimmed ? j + 1 : j;
+      }
+    }
+    a = b;
+  }
+  m_looseHint.store(0, std::memory_order_relaxed);
+
 #ifdef DEBUG
-    std::cout << " ** Checking " << p << " against " << block << std::endl;
+  std::cout << " ** Trimmed " << bytes << " bytes of allocator of size "
+            << m_blockSize << std::endl;
 #endif
-    if (p == block)
+  m_trimming.store(false, std::memory_order_release);
+  return bytes;
+}
+
+size_t BlockAllocator::trimPages(size_t first,
+    size_t last,
+    size_t pageBytes,
+    int advice)
+{
+  // The blocks overlapping the pages are held back from allocations while
+  // the pages are advised away, so none is written to in between
+  const uintptr_t start = reinterpret_cast<uintptr_t>(m_startBlock);
+  const uintptr_t base = (start + pageBytes - 1) & ~(pageBytes - 1);
+  uintptr_t from = base + first * pageBytes;
+  uintptr_t to = base + last * pageBytes;
+  size_t begin = (from - start) / m_blockSize;
+  size_t end = (to - start + m_blockSize - 1) / m_blockSize;
+  if (!holdLoose(begin, end))
+  {
+    // An allocation claimed a block first
+    m_contention.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  size_t bytes = 0;
+  if (!madvise(reinterpret_cast<void *>(from), to - from, advice))
+  {
+    for (size_t j = first; j < last;)
     {
-      present = true;
-      break;
+      size_t w = j / STATE_BITS;
+      size_t stop = ((w + 1) * STATE_BITS < last) ? (w + 1) * STATE_BITS : last;
+      m_trimmedPages[w].fetch_or(
+          bitRange(j % STATE_BITS, stop - w * STATE_BITS),
+          std::memory_order_relaxed);
+      j = stop;
     }
-    block = block->m_next;
+    bytes = to - from;
+  }
+  unholdLoose(begin, end);
+  return bytes;
+}
+
+bool BlockAllocator::pageSpan(size_t begin,
+    size_t end,
+    size_t &first,
+    size_t &last)
+{
+  size_t pageBytes = m_trimPage.load(std::memory_order_relaxed);
+  if (!pageBytes)
+  {
+    return false;
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(m_startBlock);
+  const uintptr_t base = (start + pageBytes - 1) & ~(pageBytes - 1);
+  uintptr_t from = start + begin * m_blockSize;
+  uintptr_t to = start + end * m_blockSize;
+  if (to <= base)
+  {
+    return false;
+  }
+  first = (from > base) ? (from - base) / pageBytes : 0;
+  last = (to - base + pageBytes - 1) / pageBytes;
+  last = (last < pageWords() * STATE_BITS) ? last : pageWords() * STATE_BITS;
+  return first < last;
+}
+
+bool BlockAllocator::pagesTrimmed(size_t begin, size_t end)
+{
+  size_t first;
+  size_t last;
+  if (!pageSpan(begin, end, first, last))
+  {
+    return false;
+  }
+  for (size_t j = first; j < last;)
+  {
+    size_t w = j / STATE_BITS;
+    size_t stop = ((w + 1) * STATE_BITS < last) ? (w + 1) * STATE_BITS : last;
+    if (m_trimmedPages[w].load(std::memory_order_relaxed) &
+        bitRange(j % STATE_BITS, stop - w * STATE_BITS))
+    {
+      return true;
+    }
+    j = stop;
+  }
+  return false;
+}
+
+void BlockAllocator::untrimPages(size_t begin, size_t end)
+{
+  size_t first;
+  size_t last;
+  if (!pageSpan(begin, end, first, last))
+  {
+    return;
+  }
+
+  // The marks are only read before being cleared, keeping the allocation path
+  // free of writes to the bitmap while nothing is trimmed
+  for (size_t j = first; j < last;)
+  {
+    size_t w = j / STATE_BITS;
+    size_t stop = ((w + 1) * STATE_BITS < last) ? (w + 1) * STATE_BITS : last;
+    uint64_t mask = bitRange(j % STATE_BITS, stop - w * STATE_BITS);
+    if (m_trimmedPages[w].load(std::memory_order_relaxed) & mask)
+    {
+      m_trimmedPages[w].fetch_and(~mask, std::memory_order_relaxed);
+    }
+    j = stop;
+  }
+}
+
+size_t BlockAllocator::getTrimmedBytes(size_t pageBytes)
+{
+  size_t pages = 0;
+  for (size_t w = 0; w < pageWords(); ++w)
+  {
+    pages += __builtin_popcountll(
+        m_trimmedPages[w].load(std::memory_order_relaxed));
+  }
+  return pages * pageBytes;
+}
+
+void BlockAllocator::releaseChain(MemoryBlock *head,
+    MemoryBlock *tail,
+    size_t count)
+{
+  m_released.fetch_add(count, std::memory_order_relaxed);
+
+  // Push the chain onto the remote list. Blocks only ever leave it all at
+  // once, so an untagged head is safe: a head that was taken and pushed back
+  // meanwhile is still the correct successor for the chain.
+  auto top = m_remoteHead.load(std::memory_order_relaxed);
+  tail->m_next = top;
+  while (!m_remoteHead.compare_exchange_weak(top, head,
+      std::memory_order_release, std::memory_order_relaxed))
+  {
+    // Another thread pushed first
+    m_contention.fetch_add(1, std::memory_order_relaxed);
+    tail->m_next = top;
+  }
+}
+
+bool BlockAllocator::reclaimRemote(uint64_t head)
+{
+  auto chain = m_remoteHead.exchange(nullptr, std::memory_order_acquire);
+  if (!chain)
+  {
+    return false;
+  }
+
+  // The free list is normally still empty, and the chain simply becomes it
+  if (m_freeHead.compare_exchange_strong(head, pack(chain, head),
+          std::memory_order_acq_rel, std::memory_order_relaxed))
+  {
+    return true;
+  }
+
+  // Another thread refilled the list first, so splice the chain in front
+  m_contention.fetch_add(1, std::memory_order_relaxed);
+  auto tail = chain;
+  while (tail->m_next)
+  {
+    tail = tail->m_next;
+  }
+  pushFree(chain, tail);
+  return true;
+}
+
+void BlockAllocator::pushFree(MemoryBlock *head, MemoryBlock *tail)
+{
+  // Link the chain to the beginning of the list
+  uint64_t top = m_freeHead.load(std::memory_order_relaxed);
+  tail->m_next = unpack(top);
+  while (!m_freeHead.compare_exchange_weak(top, pack(head, top),
+      std::memory_order_release, std::memory_order_relaxed))
+  {
+    // Another thread changed the list first
+    m_contention.fetch_add(1, std::memory_order_relaxed);
+    tail->m_next = unpack(top);
+  }
+}
+
+bool BlockAllocator::owns(void *p)
+{
+  size_t diff = reinterpret_cast<uint8_t *>(p) -
+                reinterpret_cast<uint8_t *>(m_startBlock);
+  return (p >= m_startBlock) && (diff < (m_blockSize * m_numBlocks));
+}
+
+bool BlockAllocator::isBlock(void *p)
+{
+  size_t i;
+  return blockIndex(p, i);
+}
+
+bool BlockAllocator::blockIndex(void *p, size_t &index)
+{
+  size_t diff = reinterpret_cast<uint8_t *>(p) -
+                reinterpret_cast<uint8_t *>(m_startBlock);
+
+  // Rotating the offset moves any bits below the power of 2 factor to the top,
+  // and multiplying by the inverse divides exact multiples of the odd factor.
+  // Both map every pointer off a block boundary, or outside the allocator
+  // space (including below it, where the offset wraps), past the last block.
+  uint64_t rotated = (uint64_t(diff) >> m_blockShift) |
+                     (uint64_t(diff) << ((64 - m_blockShift) & 63));
+  index = rotated * m_blockInverse;
+  return index < m_numBlocks;
+}
+
+uint64_t BlockAllocator::oddInverse(uint64_t d)
+{
+  // Newton's iteration: d is its own inverse modulo 8 and each step doubles
+  // the number of correct low bits (3, 6, 12, 24, 48, 96)
+  uint64_t inverse = d;
+  for (int i = 0; i < 5; ++i)
+  {
+    inverse *= 2 - d * inverse;
+  }
+  return inverse;
+}
+
+uint64_t BlockAllocator::pack(MemoryBlock *block, uint64_t head)
+{
+  // Offset is stored in units of MemoryBlock, biased by one so zero is null
+  uint64_t offset = 0;
+  if (block)
+  {
+    offset = ((reinterpret_cast<uint8_t *>(block) -
+                  reinterpret_cast<uint8_t *>(m_startBlock)) /
+                 sizeof(MemoryBlock)) +
+             1;
   }
 
-  return present;
+  // Every successful exchange bumps the tag, which defeats ABA
+  uint64_t tag = (head >> OFFSET_BITS) + 1;
+  return (tag << OFFSET_BITS) | (offset & OFFSET_MASK);
+}
+
+MemoryBlock *BlockAllocator::unpack(uint64_t head)
+{
+  uint64_t offset = head & OFFSET_MASK;
+  return offset ? m_startBlock + (offset - 1) : nullptr;
 }
 
 void BlockAllocator::showFree()
 {
 #ifdef DEBUG
 #if 1
-  std::cout << " ** Free blocks of size " << m_blockSize << std::endl;
-  auto block = m_freeBlock;
+  std::cout << " ** Free blocks of size " << m_blockSize << " ("
+            << m_numBlocks - m_carved.load(std::memory_order_relaxed)
+            << " uncarved)" << std::endl;
+  auto block = unpack(m_freeHead.load(std::memory_order_acquire));
   while (nullptr != block)
   {
     std::cout << "\tBlock @ " << block << std::endl;
     block = block->m_next;
   }
+  block = m_remoteHead.load(std::memory_order_acquire);
+  while (nullptr != block)
+  {
+    std::cout << "\tRemote block @ " << block << std::endl;
+    block = block->m_next;
+  }
   std::cout << std::endl;
 #else
   int i = 0;
-  auto block = m_freeBlock;
+  auto block = unpack(m_freeHead.load(std::memory_order_acquire));
   while (nullptr != block)
   {
     i++;
     block = block->m_next;
   }
-  std::cout << " ** " << i << " free blocks of size " << m_blockSize
-            << std::endl
+  std::cout << " ** " << i << " free blocks of size " << m_blockSize << " ("
+            << m_numBlocks - m_carved.load(std::memory_order_relaxed)
+            << " uncarved)" << std::endl
             << std::endl;
 #endif
 #endif
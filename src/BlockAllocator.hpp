@@ -1,6 +1,8 @@
+#pragma once
+
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
-#include <mutex>
 
 /**
  * @class MemoryBlock MemoryBlock
@@ -29,15 +31,54 @@ public:
  *
  * Allocation will remove the current block from the list and move the block
  * pointer to the next block in the list.  The current block is returned to the
- * user.
+ * user. Once the list is empty, fresh blocks are carved on demand off the front
+ * of the space never handed out yet (a bump pointer), so the free list only
+ * ever holds released blocks. Constructing an allocator writes nothing to its
+ * space, and pages of the space are only touched once their blocks are used.
+ *
+ * Deallocation (release) pushes the block onto a separate remote list rather
+ * than the free list itself. Releases only ever push to it and allocations
+ * only ever pop the free list, so threads freeing blocks another thread
+ * allocated never contend with that thread's allocations on the same word. The
+ * first allocation to find the free list empty reclaims the whole remote list
+ * with a single exchange and makes it the new free list.
+ *
+ * trim() hands pages holding only free blocks back to the operating system.
+ * It moves the free blocks off the lists into a loose bitmap, one bit per
+ * block, where allocations missing the lists claim them again a word at a time
+ * (like carving, faulting in only the pages they use). Advised pages are
+ * marked in a page bitmap until a block overlapping them is claimed, so any
+ * number of pages can be trimmed and none is advised twice.
+ *
+ * The free list is a lock-free (Treiber) stack: the head is a single atomic
+ * word packing the offset of the first free block with a tag that is bumped by
+ * every successful exchange, so a block that is popped and pushed back while
+ * another thread is mid-operation cannot be mistaken for an unchanged list
+ * (ABA). No thread ever waits on another, even one preempted mid-operation,
+ * or on a trim.
+ *
+ * Allocation state is tracked in a bitmap holding one bit per block (set while
+ * the block is in use), so double-release and misaligned pointers are detected
+ * in constant time with a single atomic operation rather than a walk of the
+ * free list. The bitmap storage, followed by the loose and trimmed page
+ * bitmaps, is provided by the owner of the allocator and must hold
+ * stateWords() zeroed words.
  *
- * Deallocation (release) will add the provided block back to the front of the
- * linked list and update the block pointer.
+ * Block sizes need not be powers of 2, only multiples of sizeof(MemoryBlock).
+ * A block size is split into a power of 2 and an odd factor, so turning an
+ * address into a block index is a shift and a multiply by the odd factor's
+ * inverse; no division is ever performed.
+ *
+ * Each allocator is aligned to a cache line of its own, so exchanges on the
+ * free list of one size class never invalidate the line holding another's.
  */
-class BlockAllocator
+class alignas(64) BlockAllocator
 {
 public:
-  BlockAllocator(size_t blockSize, uint32_t numBytes, MemoryBlock *p);
+  BlockAllocator(size_t blockSize,
+      size_t numBytes,
+      MemoryBlock *p,
+      std::atomic<uint64_t> *state);
   BlockAllocator() = default;
   ~BlockAllocator() = default;
   BlockAllocator(const BlockAllocator &ma);
@@ -55,10 +96,108 @@ public:
    *
    * @param p Address of the memory block to re-add to the available chain
    * @return true Block was successfully released back to the allocator
-   * @return false Block was not found to lie within the allocator page(s)
+   * @return false Block was not found to lie within the allocator page(s), is
+   * not on a block boundary, or is already free
    */
   bool releaseBlock(void *p);
 
+  /**
+   * @brief Mark a block taken from the free list as in use
+   *
+   * @param block Block being handed out
+   */
+  void setAllocated(MemoryBlock *block);
+
+  /**
+   * @brief Mark an in-use block as free ahead of returning it to a free list
+   *
+   * @param p Address of the block being released
+   * @return true Block was in use and is now marked free
+   * @return false Address is outside the allocator, not on a block boundary, or
+   * the block is already free (i.e. someone is double-calling release)
+   */
+  bool clearAllocated(void *p);
+
+  /**
+   * @brief Allocate up to n blocks with a single exchange on the free list
+   *
+   * @param[in] n Maximum number of blocks to allocate
+   * @param[out] out Array receiving the addresses of the blocks
+   * @return size_t Number of blocks allocated
+   */
+  size_t allocateBulk(size_t n, void **out);
+
+  /**
+   * @brief Release n blocks with a single exchange on the free list
+   *
+   * @param p Array of addresses of the blocks to release; addresses that are
+   * not in-use blocks of this allocator are skipped
+   * @param n Number of addresses in the array
+   * @return size_t Number of blocks released
+   */
+  size_t releaseBulk(void **p, size_t n);
+
+  /**
+   * @brief Remove up to n blocks from the chain with a single exchange
+   *
+   * The removed blocks stay linked through MemoryBlock::m_next and the last
+   * block of the returned chain is terminated with nullptr.
+   *
+   * @param[in] n Maximum number of blocks to remove
+   * @param[out] count Number of blocks actually removed
+   * @return MemoryBlock* Head of the removed chain, or nullptr if none free
+   */
+  MemoryBlock *allocateChain(size_t n, size_t &count)
+  {
+    bool carved;
+    return allocateChain(n, count, carved);
+  }
+
+  /**
+   * @brief Remove up to n blocks from the chain with a single exchange,
+   * reporting whether they were carved fresh
+   *
+   * Freshly carved blocks have never been handed out, so nothing but their
+   * MemoryBlock::m_next link has been written to them since the space was
+   * provided.
+   *
+   * @param[in] n Maximum number of blocks to remove
+   * @param[out] count Number of blocks actually removed
+   * @param[out] carved Blocks were carved off the uncarved space
+   * @return MemoryBlock* Head of the removed chain, or nullptr if none free
+   */
+  MemoryBlock *allocateChain(size_t n, size_t &count, bool &carved);
+
+  /**
+   * @brief Push a pre-linked chain of blocks onto the remote list with a
+   * single exchange (reclaimed by the next allocation finding the free list
+   * empty)
+   *
+   * @param head First block of the chain
+   * @param tail Last block of the chain (its m_next is overwritten)
+   * @param count Number of blocks in the chain
+   */
+  void releaseChain(MemoryBlock *head, MemoryBlock *tail, size_t count);
+
+  /**
+   * @brief Determine if an address lies within the allocator memory space
+   *
+   * @param p Address to check
+   * @return true Address lies within the allocator page(s)
+   * @return false Address belongs to some other memory
+   */
+  bool owns(void *p);
+
+  /**
+   * @brief Determine if a block is currently marked as in use
+   *
+   * @param p Address of the block
+   * @return true Block is in use
+   * @return false Block is free, or the address is not a block of this
+   * allocator
+   */
+  bool isAllocated(void *p);
+
   /**
    * @brief Get the start address of the allocator
    *
@@ -79,29 +218,319 @@ public:
    */
   size_t getBlockSize() { return m_blockSize; }
 
+  /**
+   * @brief Get the number of blocks carved for this allocator
+   *
+   * @return size_t Number of blocks
+   */
+  size_t getBlockCount() { return m_numBlocks; }
+
+  /**
+   * @brief Get the number of times an exchange on the free list lost a race
+   * with another thread and had to be retried
+   *
+   * @return uint64_t Number of contention events
+   */
+  uint64_t getContention()
+  {
+    return m_contention.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Get the number of blocks given back to the allocator, by their
+   * users or by thread caches
+   *
+   * @return uint64_t Number of blocks released since the allocator was built
+   */
+  uint64_t getReleases() { return m_released.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Get the largest number of blocks out of the allocator at once,
+   * handed out or held by thread caches
+   *
+   * @return uint64_t High-water mark of the blocks taken and not given back
+   */
+  uint64_t getHighWater()
+  {
+    return m_highWater.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Return the pages holding only free blocks to the operating system
+   *
+   * The blocks on the shared free and remote lists are moved one at a time to
+   * the loose bitmap, where allocations can claim them throughout. Runs of
+   * loose blocks are then scanned for whole pages not already trimmed, which
+   * are advised away TRIM_CHUNK pages at a time while their blocks are held
+   * back from allocations. A chunk losing a block to an allocation first is
+   * skipped. An allocation only misses a free block while it sits in the one
+   * chunk being advised. Blocks held in thread caches keep their pages
+   * resident. Only one trim runs at a time; a concurrent call returns straight
+   * away.
+   *
+   * @param pageBytes Page size of the space (0 disables trimming)
+   * @param advice madvise() advice releasing the pages, MADV_DONTNEED or
+   * MADV_FREE
+   * @return size_t Bytes of the space returned to the operating system
+   */
+  size_t trim(size_t pageBytes, int advice);
+
+  /**
+   * @brief Get the number of bytes of pages advised away and not written to
+   * since (approximate while other threads allocate)
+   *
+   * @param pageBytes Page size of the space
+   * @return size_t Bytes of the space returned to the operating system
+   */
+  size_t getTrimmedBytes(size_t pageBytes);
+
   /**
    * @brief Debug routine to show number of free blocks in allocator
    */
   void showFree();
 
+  /**
+   * @brief Number of state bitmap words needed for an allocator
+   *
+   * @param numBlocks Number of blocks in the allocator
+   * @param blockSize Size of each block
+   * @return size_t Number of 64-bit words of bitmap storage
+   */
+  static constexpr size_t stateWords(size_t numBlocks, size_t blockSize)
+  {
+    return 2 * ((numBlocks + STATE_BITS - 1) / STATE_BITS) +
+           (numBlocks * blockSize / TRIM_PAGE_MIN + STATE_BITS - 1) /
+               STATE_BITS;
+  }
+
+  /** @brief Number of blocks tracked by each state bitmap word */
+  static constexpr size_t STATE_BITS = 64;
+
+  /** @brief Smallest page size the trimmed page bitmap is sized for */
+  static constexpr size_t TRIM_PAGE_MIN = 4096;
+
+  /** @brief Largest number of pages advised away at once by a trim */
+  static constexpr size_t TRIM_CHUNK = 16;
+
+  /** @brief Largest memory space addressable by the free list head word */
+  static constexpr size_t MAX_BYTES = size_t(0xFFFFFFFF) * sizeof(MemoryBlock);
+
 private:
   /**
-   * @brief Determine if block is already in free list or not
+   * @brief Determine if an address is the start of a block in this allocator
+   *
+   * @param p Address to check
+   * @return true Address is a block boundary inside the allocator space
+   * @return false Address is outside the allocator space or misaligned
+   */
+  bool isBlock(void *p);
+
+  /**
+   * @brief Find the index of the block starting at an address
+   *
+   * @param[in] p Address to check
+   * @param[out] index Index of the block within the allocator
+   * @return true Address is a block boundary inside the allocator space
+   * @return false Address is outside the allocator space or misaligned
+   */
+  bool blockIndex(void *p, size_t &index);
+
+  /**
+   * @brief Number of words of the trimmed page bitmap
+   */
+  size_t pageWords()
+  {
+    return (m_numBlocks * m_blockSize / TRIM_PAGE_MIN + STATE_BITS - 1) /
+           STATE_BITS;
+  }
+
+  /**
+   * @brief Mask of bits [lo, hi) of a bitmap word
+   */
+  static uint64_t bitRange(size_t lo, size_t hi)
+  {
+    return ((hi - lo < STATE_BITS) ? (uint64_t(1) << (hi - lo)) - 1
+                                   : ~uint64_t(0))
+           << lo;
+  }
+
+  /**
+   * @brief Multiplicative inverse of an odd number modulo 2^64, so dividing an
+   * exact multiple of d is a single multiply
+   *
+   * @param d Odd divisor
+   * @return uint64_t Inverse of d
+   */
+  static uint64_t oddInverse(uint64_t d);
+
+  /**
+   * @brief Count blocks taken from the allocator, raising the high-water mark
+   * if more are out than ever before
+   */
+  void countTaken(size_t count);
+
+  /**
+   * @brief Claim up to n never used blocks off the front of the uncarved space
+   * and link them into a chain
+   *
+   * @param[in] n Maximum number of blocks to carve
+   * @param[out] count Number of blocks actually carved
+   * @return MemoryBlock* Head of the chain, or nullptr if the space is all
+   * carved
+   */
+  MemoryBlock *carveChain(size_t n, size_t &count);
+
+  /**
+   * @brief Claim up to n loose blocks sharing a loose bitmap word and link
+   * them into a chain
+   *
+   * @param[in] n Maximum number of blocks to claim
+   * @param[out] count Number of blocks actually claimed
+   * @return MemoryBlock* Head of the claimed chain, or nullptr if no block is
+   * loose
+   */
+  MemoryBlock *claimLoose(size_t n, size_t &count);
+
+  /**
+   * @brief Move a block taken off the free list by a trim to the loose bitmap
+   *
+   * @param block Block owned by the trim
+   */
+  void setLoose(MemoryBlock *block);
+
+  /**
+   * @brief Take the loose bits of blocks [begin, end) for a trim
+   *
+   * @param begin Index of the first block
+   * @param end Index past the last block
+   * @return true Every block was loose and is now owned by the trim
+   * @return false Some block was claimed first; none is taken
+   */
+  bool holdLoose(size_t begin, size_t end);
+
+  /**
+   * @brief Set the loose bits of blocks [begin, end) held by a trim
+   */
+  void unholdLoose(size_t begin, size_t end);
+
+  /**
+   * @brief Advise away pages [first, last) of the page bitmap, whose blocks
+   * are all loose
    *
-   * @param p Pointer to look for in free list
-   * @return true Block is present in the list
-   * @return false Block is not present in the list
+   * @param first Index of the first page
+   * @param last Index past the last page
+   * @param pageBytes Page size of the space
+   * @param advice madvise() advice releasing the pages
+   * @return size_t Bytes advised away, 0 if a block was claimed meanwhile
    */
-  bool inChain(void *p);
+  size_t trimPages(size_t first, size_t last, size_t pageBytes, int advice);
+
+  /**
+   * @brief Clear the trimmed marks of the pages overlapped by blocks
+   * [begin, end), which are about to be written
+   */
+  void untrimPages(size_t begin, size_t end);
+
+  /**
+   * @brief Determine if any page overlapped by blocks [begin, end) is trimmed
+   */
+  bool pagesTrimmed(size_t begin, size_t end);
+
+  /**
+   * @brief Find the pages [first, last) of the trimmed page bitmap overlapped
+   * by blocks [begin, end)
+   *
+   * @return true Some page is overlapped
+   * @return false No page is, or the allocator was never trimmed
+   */
+  bool pageSpan(size_t begin, size_t end, size_t &first, size_t &last);
+
+  /**
+   * @brief Link consecutive blocks claimed by this thread into a chain
+   *
+   * @param first Index of the first block
+   * @param count Number of blocks, at least 1
+   * @return MemoryBlock* Head of the chain, terminated with nullptr
+   */
+  MemoryBlock *linkBlocks(size_t first, size_t count);
+
+  /**
+   * @brief Take every block on the remote list and make it the free list
+   *
+   * @param head Free list head word observed empty
+   * @return true Blocks were reclaimed, the free list should be read again
+   * @return false Remote list was empty
+   */
+  bool reclaimRemote(uint64_t head);
+
+  /**
+   * @brief Splice a pre-linked chain of blocks onto the free list
+   *
+   * @param head First block of the chain
+   * @param tail Last block of the chain (its m_next is overwritten)
+   */
+  void pushFree(MemoryBlock *head, MemoryBlock *tail);
+
+  /**
+   * @brief Build a new free list head word pointing at block
+   *
+   * @param block Block to become the head of the list (can be nullptr)
+   * @param head Current head word, whose tag is advanced
+   * @return uint64_t Tagged head word
+   */
+  uint64_t pack(MemoryBlock *block, uint64_t head);
+
+  /**
+   * @brief Extract the block referenced by a free list head word
+   *
+   * @param head Tagged head word
+   * @return MemoryBlock* Block at the head of the list, or nullptr if empty
+   */
+  MemoryBlock *unpack(uint64_t head);
+
+  /** @brief Number of low bits of the head word holding the block offset */
+  static constexpr unsigned OFFSET_BITS = 32;
+  /** @brief Mask selecting the block offset from the head word */
+  static constexpr uint64_t OFFSET_MASK = (uint64_t(1) << OFFSET_BITS) - 1;
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+      "Free list head must be a lock-free atomic");
 
   /** @brief Block size for this allocator */
   size_t m_blockSize;
+  /** @brief Power of 2 factor of m_blockSize, as a shift */
+  size_t m_blockShift;
+  /** @brief Inverse of the odd factor of m_blockSize (see oddInverse()) */
+  uint64_t m_blockInverse;
   /** @brief Number of blocks available to the allocator */
   size_t m_numBlocks;
-  /** @brief Pointer to the next available block in the allocator */
-  MemoryBlock *m_freeBlock{nullptr};
   /** @brief Pointer to the first block in the allocator */
   MemoryBlock *m_startBlock{nullptr};
-  /** @brief Mutex to protect pointers during allocation/deallocation */
-  std::mutex m_lock;
+  /** @brief Tagged offset of the next available block in the allocator */
+  std::atomic<uint64_t> m_freeHead{0};
+  /** @brief Number of blocks carved off the front of the space so far */
+  std::atomic<size_t> m_carved{0};
+  /** @brief Number of blocks taken from the allocator */
+  std::atomic<uint64_t> m_taken{0};
+  /** @brief Largest number of blocks taken and not yet released */
+  std::atomic<uint64_t> m_highWater{0};
+  /** @brief Most recently released block, kept off the free list line */
+  alignas(64) std::atomic<MemoryBlock *> m_remoteHead{nullptr};
+  /** @brief Number of blocks released to the allocator */
+  std::atomic<uint64_t> m_released{0};
+  /** @brief Upper bound of the number of loose blocks */
+  std::atomic<size_t> m_looseCount{0};
+  /** @brief Loose bitmap word most recently claimed from */
+  std::atomic<size_t> m_looseHint{0};
+  /** @brief Page size of the trimmed page bitmap, set by the first trim */
+  std::atomic<size_t> m_trimPage{0};
+  /** @brief Flag denoting a trim is running */
+  std::atomic<bool> m_trimming{false};
+  /** @brief Number of retried free list exchanges */
+  std::atomic<uint64_t> m_contention{0};
+  /** @brief Allocation state bitmap, one bit per block */
+  std::atomic<uint64_t> *m_state{nullptr};
+  /** @brief Loose bitmap, one bit per free block on no list */
+  std::atomic<uint64_t> *m_loose{nullptr};
+  /** @brief Trimmed page bitmap, one bit per whole page advised away */
+  std::atomic<uint64_t> *m_trimmedPages{nullptr};
 };
\ No newline at end of file
@@ -1,49 +1,184 @@
 #include "MemoryPool.hpp"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <malloc.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
 #ifdef DEBUG
 #include <iostream>
 #endif
 
+#ifdef POOL_STATIC_HEAP
 // Statically define the memory pool storage
-uint8_t MemoryPool::s_pool_heap[POOLSIZE_BYTES];
+alignas(4096) uint8_t MemoryPool::s_pool_heap[POOLSIZE_BYTES];
+std::atomic<uint64_t> MemoryPool::s_pool_state[STATE_WORDS];
+std::atomic<bool> MemoryPool::s_pool_heap_used{false};
+std::atomic<bool> MemoryPool::s_pool_heap_dirty{false};
+#endif
+
+// Per-thread caches of free blocks, flushed back to their pools on thread exit
+static thread_local ThreadCacheTable t_caches;
 
 MemoryPool &MemoryPool::getPool(const size_t *blockSize, const size_t nSizes)
+{
+  PoolConfig config;
+  config.blockSizes = blockSize;
+  config.nSizes = nSizes;
+  return getPool(config);
+}
+
+MemoryPool &MemoryPool::getPool(const PoolConfig &config)
 {
   // Core of the Meyer's singleton. Static declaration here ensures this is
   // constructed *exactly* one time through the entire life of the application
-  static MemoryPool s_pool(blockSize, nSizes);
+  static MemoryPool s_pool(config);
   return s_pool;
 }
 
 void *MemoryPool::allocate(size_t n)
+{
+  bool carved;
+  return allocateBlock(n, carved);
+}
+
+void *MemoryPool::allocateZeroed(size_t n)
+{
+  bool carved;
+  void *p = allocateBlock(n, carved);
+  if (!p)
+  {
+    return p;
+  }
+
+  // A block carved from zero filled memory only had its link written
+  if (carved && m_heapZeroed)
+  {
+    static_cast<MemoryBlock *>(p)->m_next = nullptr;
+    return p;
+  }
+  return memset(p, 0, n);
+}
+
+void *MemoryPool::allocateBlock(size_t n, bool &carved)
 {
   MemoryBlock *block = nullptr;
+  carved = false;
+  if (!m_initialized)
+  {
+    return block;
+  }
 
-  for (size_t i = 0; i < m_nAllocators; ++i)
+  ThreadCache &cache = threadCache();
+  size_t depth = m_cacheDepth.load(std::memory_order_relaxed);
+
+  // The lookup table gives the smallest allocator whose block size is greater
+  // than or equal to the requested number of bytes; every allocator after it
+  // serves larger blocks, as far as the overflow policy lets requests borrow.
+  size_t first = m_classIndex[sizeClass(n)];
+  size_t last = (m_nAllocators - first > m_borrowSpan)
+                    ? first + 1 + m_borrowSpan
+                    : m_nAllocators;
+  for (size_t i = first; i < last; ++i)
   {
-    // If the allocator block size is greater than or equal to the requested
-    // number of bytes, request a block from this allocator.
-    if (m_allocator[i].getBlockSize() >= n)
+    block = cache.allocate(i, depth, carved);
+
+    // Need to check if the block was allocated from this pool, because if it
+    // failed to allocate from the smallest pool, then we should allocate a
+    // block from a larger pool
+    if (block)
     {
-      block = m_allocator[i].allocateBlock();
+      m_allocator[i].setAllocated(block);
+      countAllocations(cache, first, i, 1);
+#ifdef DEBUG
+      std::cout << " ** Allocated block of size "
+                << m_allocator[i].getBlockSize() << " for " << n << " bytes @ "
+                << block << std::endl;
+      m_allocator[i].showFree();
+#endif
+      break;
+    }
+  }
 
-      // Need to check if the block was allocated from this pool, because if it
-      // failed to allocate from the smallest pool, then we should allocate a
-      // block from a larger pool
+  void *p = block ? block : allocateOverflow(n, ALIGN_MAX, first);
+  if (!p)
+  {
+    countFailures(first, 1);
+  }
+  if (m_sampleRate.load(std::memory_order_relaxed))
+  {
+    sample(p, n);
+  }
+  return p;
+}
+
+void *MemoryPool::allocate(size_t n, size_t align)
+{
+  if (!align || (align & (align - 1)))
+  {
+    return nullptr;
+  }
+
+  // A block at least as large as the alignment has it, up to ALIGN_MAX
+  n = (n > align) ? n : align;
+  if (align <= ALIGN_MAX)
+  {
+    return allocate(n);
+  }
+
+  MemoryBlock *block = nullptr;
+  if (!m_initialized)
+  {
+    return block;
+  }
+
+  ThreadCache &cache = threadCache();
+  size_t depth = m_cacheDepth.load(std::memory_order_relaxed);
+
+  // Requests start at the smallest allocator holding n bytes whose blocks have
+  // the alignment, and may only borrow from others that have it too
+  size_t first = m_classIndex[sizeClass(n)];
+  while ((first < m_nAllocators) && (allocatorAlign(first) < align))
+  {
+    ++first;
+  }
+  size_t last = (m_nAllocators - first > m_borrowSpan)
+                    ? first + 1 + m_borrowSpan
+                    : m_nAllocators;
+  for (size_t i = first; !block && (i < last); ++i)
+  {
+    if (allocatorAlign(i) >= align)
+    {
+      block = cache.allocate(i, depth);
       if (block)
       {
+        m_allocator[i].setAllocated(block);
+        countAllocations(cache, first, i, 1);
 #ifdef DEBUG
         std::cout << " ** Allocated block of size "
                   << m_allocator[i].getBlockSize() << " for " << n
-                  << " bytes @ " << block << std::endl;
-        m_allocator[i].showFree();
+                  << " bytes aligned to " << align << " @ " << block
+                  << std::endl;
 #endif
-        break;
       }
     }
   }
 
-  return block;
+  void *p = block ? block : allocateOverflow(n, align, first);
+  if (!p)
+  {
+    countFailures(first, 1);
+  }
+  if (m_sampleRate.load(std::memory_order_relaxed))
+  {
+    sample(p, n);
+  }
+  return p;
 }
 
 void MemoryPool::release(void *p)
@@ -52,31 +187,535 @@ void MemoryPool::release(void *p)
   std::cout << " ** Releasing block @ " << p << std::endl;
 #endif
 
-  // Ask each allocator to release, in turn, until block is released to the pool
+  // Reject anything outside the heap with a single compare; a pointer below
+  // the heap wraps around to a huge offset
+  size_t offset = reinterpret_cast<uintptr_t>(p) -
+                  reinterpret_cast<uintptr_t>(m_heap);
+  if (offset >= m_heapBytes)
+  {
+    releaseOverflow(p);
+    return;
+  }
+
+  releaseTo(allocatorOf(offset), p);
+}
+
+void MemoryPool::release(void *p, size_t n)
+{
+  size_t i = m_classIndex[sizeClass(n)];
+
+#ifdef DEBUG
+  size_t offset = reinterpret_cast<uintptr_t>(p) -
+                  reinterpret_cast<uintptr_t>(m_heap);
+  if ((offset < m_heapBytes) &&
+      (m_allocator[allocatorOf(offset)].getBlockSize() < n))
+  {
+    std::cerr << " !! Block @ " << p << " of size "
+              << m_allocator[allocatorOf(offset)].getBlockSize()
+              << " released as " << n << " bytes!" << std::endl;
+  }
+#endif
+
+  if ((i < m_nAllocators) && releaseTo(i, p))
+  {
+    return;
+  }
+
+  release(p);
+}
+
+void *MemoryPool::reallocate(void *p, size_t n)
+{
+  if (!p)
+  {
+    return allocate(n);
+  }
+  if (0 == n)
+  {
+    release(p);
+    return nullptr;
+  }
+
+  size_t offset = reinterpret_cast<uintptr_t>(p) -
+                  reinterpret_cast<uintptr_t>(m_heap);
+  if (offset >= m_heapBytes)
+  {
+    // Overflow allocations keep growing in place up to their usable size
+    size_t size = overflowSize(p);
+    if (!size || (n <= size))
+    {
+      return size ? p : nullptr;
+    }
+    void *q = allocate(n);
+    if (q)
+    {
+      memcpy(q, p, size);
+      releaseOverflow(p);
+    }
+    return q;
+  }
+
+  // The allocator found once both sizes the block and takes it back
+  size_t i = allocatorOf(offset);
+  if (!m_allocator[i].isAllocated(p))
+  {
+    return nullptr;
+  }
+
+  // The block is kept while it holds n bytes, unless a block at most half its
+  // size would do; moving a block to save less is not worth the copy
+  size_t size = m_allocator[i].getBlockSize();
+  size_t first = m_classIndex[sizeClass(n)];
+  if ((n <= size) && (2 * m_allocator[first].getBlockSize() > size))
+  {
+    return p;
+  }
+
+  void *q = allocate(n);
+  if (!q)
+  {
+    // A block that cannot shrink still holds the data
+    return (n <= size) ? p : nullptr;
+  }
+  memcpy(q, p, (n < size) ? n : size);
+  releaseTo(i, p);
+#ifdef DEBUG
+  std::cout << " ** Moved block @ " << p << " of size " << size << " to " << q
+            << " for " << n << " bytes" << std::endl;
+#endif
+  return q;
+}
+
+bool MemoryPool::releaseTo(size_t i, void *p)
+{
+  // Flipping the allocation state bit rejects a block that is already free
+  // (i.e. someone is double-calling release) or a pointer that does not fall
+  // on a block boundary
+  if (!m_allocator[i].clearAllocated(p))
+  {
+    return false;
+  }
+
+  unsample(p);
+  ThreadCache &cache = threadCache();
+  cache.countFrees(i, 1);
+  cache.release(i, reinterpret_cast<MemoryBlock *>(p),
+      m_cacheDepth.load(std::memory_order_relaxed));
+#ifdef DEBUG
+  std::cout << " ** Freed block @ " << p << " back to allocator of size "
+            << m_allocator[i].getBlockSize() << std::endl;
+#endif
+  return true;
+}
+
+size_t MemoryPool::allocateBulk(size_t n, size_t count, void **out)
+{
+  size_t done = 0;
+  if (!m_initialized)
+  {
+    return done;
+  }
+
+  // Take whole chains from the smallest allocator that fits, falling through
+  // to larger ones as each runs out
+  ThreadCache &cache = threadCache();
+  size_t first = m_classIndex[sizeClass(n)];
+  size_t last = (m_nAllocators - first > m_borrowSpan)
+                    ? first + 1 + m_borrowSpan
+                    : m_nAllocators;
+  for (size_t i = first; (done < count) && (i < last); ++i)
+  {
+    size_t got = m_allocator[i].allocateBulk(count - done, out + done);
+    if (got)
+    {
+      countAllocations(cache, first, i, got);
+      done += got;
+    }
+  }
+
+  // The overflow serves the rest one block at a time
+  while ((done < count) && (out[done] = allocateOverflow(n, ALIGN_MAX, first)))
+  {
+    ++done;
+  }
+  if (done < count)
+  {
+    countFailures(first, count - done);
+  }
+  if (m_sampleRate.load(std::memory_order_relaxed))
+  {
+    for (size_t k = 0; k < done; ++k)
+    {
+      sample(out[k], n);
+    }
+  }
+
+#ifdef DEBUG
+  std::cout << " ** Allocated " << done << " of " << count << " blocks for "
+            << n << " bytes" << std::endl;
+#endif
+  return done;
+}
+
+void MemoryPool::releaseBulk(void **p, size_t count)
+{
+  MemoryBlock *head[BLKCNT_MAX] = {};
+  MemoryBlock *tail[BLKCNT_MAX] = {};
+  size_t freed[BLKCNT_MAX] = {};
+
+  // Sort the blocks into one private chain per allocator
+  for (size_t k = 0; k < count; ++k)
+  {
+    size_t offset = reinterpret_cast<uintptr_t>(p[k]) -
+                    reinterpret_cast<uintptr_t>(m_heap);
+    if (offset >= m_heapBytes)
+    {
+      releaseOverflow(p[k]);
+      continue;
+    }
+
+    size_t i = allocatorOf(offset);
+    if (m_allocator[i].clearAllocated(p[k]))
+    {
+      unsample(p[k]);
+      ++freed[i];
+      auto block = reinterpret_cast<MemoryBlock *>(p[k]);
+      block->m_next = head[i];
+      tail[i] = head[i] ? tail[i] : block;
+      head[i] = block;
+    }
+  }
+
+  // Splice each chain onto its free list with a single exchange
+  ThreadCache &cache = threadCache();
   for (size_t i = 0; i < m_nAllocators; ++i)
   {
-    if (m_allocator[i].releaseBlock(p))
+    if (head[i])
     {
-      break;
+      cache.countFrees(i, freed[i]);
+      m_allocator[i].releaseChain(head[i], tail[i], freed[i]);
+#ifdef DEBUG
+      std::cout << " ** Freed chain back to allocator of size "
+                << m_allocator[i].getBlockSize() << std::endl;
+#endif
     }
   }
 }
 
-MemoryPool::MemoryPool(const size_t *blockSize, const size_t nSizes)
+PoolStats MemoryPool::getStats()
+{
+  PoolStats stats;
+  stats.nClasses = m_nAllocators;
+
+  // Allocations and releases are summed over the thread caches, which count
+  // them privately
+  uint64_t allocations[ThreadCache::BIN_MAX];
+  uint64_t frees[ThreadCache::BIN_MAX];
+  ThreadCacheTable::countBlocks(m_registration, allocations, frees);
+  for (size_t i = 0; i < m_nAllocators; ++i)
+  {
+    ClassCounters &c = m_counters[i];
+    PoolClassStats &s = stats.classes[i];
+    s.blockSize = m_allocator[i].getBlockSize();
+    s.blockCount = m_allocator[i].getBlockCount();
+
+    // A block released by another thread than the one allocating it may be
+    // counted before its allocation, so the difference is clamped
+    s.frees = frees[i];
+    s.allocations = allocations[i];
+    s.inUse = (s.allocations > s.frees) ? s.allocations - s.frees : 0;
+    s.highWater = m_allocator[i].getHighWater();
+    s.failures = c.m_failures.load(std::memory_order_relaxed);
+    s.fallThroughs = c.m_fallThroughs.load(std::memory_order_relaxed);
+    s.overflows = c.m_overflows.load(std::memory_order_relaxed);
+    s.contention = m_allocator[i].getContention();
+    s.trimmedBytes = m_allocator[i].getTrimmedBytes(m_trimPage);
+  }
+  stats.oversize = m_oversize.load(std::memory_order_relaxed);
+  stats.overflows = m_overflows.load(std::memory_order_relaxed);
+  stats.overflowFrees = m_overflowFrees.load(std::memory_order_relaxed);
+  return stats;
+}
+
+size_t MemoryPool::trim()
 {
+  if (!m_initialized || !m_trimPage)
+  {
+    return 0;
+  }
+
+  // Blocks cached by this thread would keep their pages resident
+  threadCache().flush();
+
+  size_t bytes = 0;
+  for (size_t i = 0; i < m_nAllocators; ++i)
+  {
+    bytes += m_allocator[i].trim(m_trimPage, m_trimAdvice);
+  }
 #ifdef DEBUG
-  std::cout << " ** s_pool_heap @ " << static_cast<void *>(s_pool_heap)
+  std::cout << " ** Trimmed " << bytes << " bytes of the pool heap"
             << std::endl;
 #endif
+  return bytes;
+}
+
+void MemoryPool::trimLoop(unsigned interval)
+{
+  uint64_t trimmedFrees = 0;
+  std::unique_lock<std::mutex> lk(m_trimLock);
+  while (!m_trimWake.wait_for(lk, std::chrono::milliseconds(interval),
+      [this]() { return m_trimStop; }))
+  {
+    // Only blocks released since the previous pass can have emptied a page
+    uint64_t frees = 0;
+    for (size_t i = 0; i < m_nAllocators; ++i)
+    {
+      frees += m_allocator[i].getReleases();
+    }
+    if (frees != trimmedFrees)
+    {
+      trimmedFrees = frees;
+      lk.unlock();
+      trim();
+      lk.lock();
+    }
+  }
+}
+
+bool MemoryPool::setSampleRate(size_t bytes)
+{
+  // The sampler is only ever replaced by the destructor, so racing callers
+  // keep the first one installed
+  if (bytes && !m_sampler.load(std::memory_order_acquire))
+  {
+    PoolSampler *sampler = new (std::nothrow) PoolSampler();
+    PoolSampler *none = nullptr;
+    if (!sampler)
+    {
+      return false;
+    }
+    if (!m_sampler.compare_exchange_strong(none, sampler,
+            std::memory_order_acq_rel))
+    {
+      delete sampler;
+    }
+  }
+  m_sampleRate = bytes;
+  return true;
+}
+
+size_t MemoryPool::dumpSamples(std::ostream &out, unsigned format)
+{
+  PoolSampler *sampler = m_sampler.load(std::memory_order_acquire);
+  return sampler ? sampler->dump(out, format, m_sampleRate) : 0;
+}
+
+void MemoryPool::sample(void *p, size_t n)
+{
+  size_t rate = m_sampleRate.load(std::memory_order_relaxed);
+  if (!p || !rate || !PoolSampler::tick(n, rate))
+  {
+    return;
+  }
+
+  size_t offset = reinterpret_cast<uintptr_t>(p) -
+                  reinterpret_cast<uintptr_t>(m_heap);
+  size_t blockSize = (offset < m_heapBytes)
+                         ? m_allocator[allocatorOf(offset)].getBlockSize()
+                         : 0;
+  m_sampler.load(std::memory_order_acquire)->record(p, n, blockSize);
+#ifdef DEBUG
+  std::cout << " ** Sampled " << n << " bytes @ " << p << std::endl;
+#endif
+}
+
+void MemoryPool::unsample(const void *p)
+{
+  if (PoolSampler *sampler = m_sampler.load(std::memory_order_acquire))
+  {
+    sampler->remove(p);
+  }
+}
+
+size_t MemoryPool::overflowSize(const void *p)
+{
+  if (PoolConfig::OVERFLOW_HEAP == m_overflow)
+  {
+    return m_overflowHeap->usableSize(p);
+  }
+  if (PoolConfig::OVERFLOW_MALLOC == m_overflow)
+  {
+    std::lock_guard<std::mutex> lk(m_overflowLock);
+    return m_overflowBlocks.count(p)
+               ? malloc_usable_size(const_cast<void *>(p))
+               : 0;
+  }
+  return 0;
+}
+
+bool MemoryPool::isOverflow(const void *p)
+{
+  if (PoolConfig::OVERFLOW_HEAP == m_overflow)
+  {
+    return m_overflowHeap->owns(p) || m_overflowHeap->isOverflow(p);
+  }
+  if (PoolConfig::OVERFLOW_MALLOC == m_overflow)
+  {
+    std::lock_guard<std::mutex> lk(m_overflowLock);
+    return m_overflowBlocks.count(p) != 0;
+  }
+  return false;
+}
+
+void *MemoryPool::allocateOverflow(size_t n, size_t align, size_t first)
+{
+  void *p = nullptr;
+  if (PoolConfig::OVERFLOW_HEAP == m_overflow)
+  {
+    p = (align > ALIGN_MAX) ? m_overflowHeap->allocate(n, align)
+                            : m_overflowHeap->allocate(n);
+  }
+  else if (PoolConfig::OVERFLOW_MALLOC == m_overflow)
+  {
+    // Remember the block so release() can tell it from foreign pointers
+    if (align > ALIGN_MAX)
+    {
+      p = ::posix_memalign(&p, align, n ? n : 1) ? nullptr : p;
+    }
+    else
+    {
+      p = std::malloc(n ? n : 1);
+    }
+    if (p)
+    {
+      std::lock_guard<std::mutex> lk(m_overflowLock);
+      try
+      {
+        m_overflowBlocks.insert(p);
+      }
+      catch (const std::bad_alloc &)
+      {
+        std::free(p);
+        p = nullptr;
+      }
+    }
+  }
+
+  if (p)
+  {
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+    if (first < m_nAllocators)
+    {
+      m_counters[first].m_overflows.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+      m_oversize.fetch_add(1, std::memory_order_relaxed);
+    }
+#ifdef DEBUG
+    std::cout << " ** Overflowed " << n << " bytes to "
+              << ((PoolConfig::OVERFLOW_HEAP == m_overflow) ? "heap" : "malloc")
+              << " @ " << p << std::endl;
+#endif
+  }
+  return p;
+}
+
+bool MemoryPool::releaseOverflow(void *p)
+{
+  unsample(p);
+  bool released = false;
+  if (PoolConfig::OVERFLOW_HEAP == m_overflow)
+  {
+    if (m_overflowHeap->owns(p))
+    {
+      m_overflowHeap->release(p);
+      released = true;
+    }
+    else
+    {
+      released = m_overflowHeap->releaseOverflow(p);
+    }
+  }
+  else if (PoolConfig::OVERFLOW_MALLOC == m_overflow)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_overflowLock);
+      released = m_overflowBlocks.erase(p) != 0;
+    }
+    if (released)
+    {
+      std::free(p);
+    }
+  }
+
+  if (released)
+  {
+    m_overflowFrees.fetch_add(1, std::memory_order_relaxed);
+#ifdef DEBUG
+    std::cout << " ** Freed overflow block @ " << p << std::endl;
+#endif
+  }
+  return released;
+}
+
+void MemoryPool::countFailures(size_t first, uint64_t n)
+{
+  if (first < m_nAllocators)
+  {
+    m_counters[first].m_failures.fetch_add(n, std::memory_order_relaxed);
+  }
+  else
+  {
+    m_oversize.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+MemoryPool::MemoryPool(const PoolConfig &config)
+{
+  const size_t nSizes = config.nSizes;
 
   // First run sanity checks on user input
-  if (!scrubBlockSizes(blockSize, nSizes))
+  if (!scrubBlockSizes(config) || !setupOverflow(config) ||
+      !setupTrim(config))
   {
     return;
   }
 
+  // Work on a copy of the block sizes, each paired with its byte budget (0 to
+  // share the rest of the heap), so the caller's arrays are left untouched
+  size_t blockSize[BLKCNT_MAX];
+  size_t budget[BLKCNT_MAX];
+  size_t budgeted = 0;
+  for (size_t i = 0; i < nSizes; ++i)
+  {
+    blockSize[i] = config.blockSizes[i];
+    budget[i] = 0;
+    if (config.blockCounts && config.blockCounts[i])
+    {
+      budget[i] = config.blockCounts[i] * blockSize[i];
+    }
+    else if (config.byteBudgets && config.byteBudgets[i])
+    {
+      budget[i] = (config.byteBudgets[i] / blockSize[i]) * blockSize[i];
+    }
+    budgeted += budget[i] ? 1 : 0;
+  }
+
+  // Without an explicit heap size, a fully budgeted pool is exactly as large
+  // as its budgets
+  size_t heapBytes = config.heapBytes ? config.heapBytes : POOLSIZE_BYTES;
+  if (!config.heapBytes && (budgeted == nSizes))
+  {
+    heapBytes = 0;
+    for (size_t i = 0; i < nSizes; ++i)
+    {
+      heapBytes += budget[i];
+    }
+  }
+
   // Ensure the array is sorted to initialize allocators in ascending order
-  sortArray(const_cast<size_t *>(blockSize), nSizes);
+  sortArray(blockSize, budget, nSizes);
 #ifdef DEBUG
   std::cout << " ** Block sizes [";
   for (size_t i = 0; i < nSizes; i++)
@@ -86,34 +725,337 @@ MemoryPool::MemoryPool(const size_t *blockSize, const size_t nSizes)
   std::cout << " ]" << std::endl << std::endl;
 #endif
 
+  m_nAllocators = nSizes;
+  size_t slice[BLKCNT_MAX];
+  std::atomic<uint64_t> *state = nullptr;
+  if (!setupHeap(config, heapBytes, blockSize, budget, slice, state))
+  {
+    m_nAllocators = 0;
+    m_initialized = false;
+    return;
+  }
+#ifdef DEBUG
+  std::cout << " ** Pool heap @ " << static_cast<void *>(m_heap) << std::endl;
+#endif
+
+  // Lay the slices out by decreasing block alignment (the largest power of 2
+  // dividing the block size), then decreasing size. Every slice is a whole
+  // number of its blocks, so each slice start stays aligned for the slices
+  // that follow it without any padding.
+  for (size_t j = 0; j < nSizes; ++j)
+  {
+    size_t i = nSizes - 1 - j;
+    size_t k = j;
+    while ((k > 0) && (blockAlign(blockSize[m_sliceOwner[k - 1]]) <
+                          blockAlign(blockSize[i])))
+    {
+      m_sliceOwner[k] = m_sliceOwner[k - 1];
+      --k;
+    }
+    m_sliceOwner[k] = static_cast<uint8_t>(i);
+  }
+
   // Allocate the allocators which handle allocating blocks for each block size
-  m_poolSize = POOLSIZE_BYTES / nSizes;
+  size_t offset = 0;
+  for (size_t j = 0; j < nSizes; ++j)
+  {
+    size_t i = m_sliceOwner[j];
+    void *p = &m_heap[offset];
+#ifdef DEBUG
+    std::cout << " ** Block[" << i << "]: size = " << blockSize[i] << " x "
+              << slice[i] / blockSize[i] << " @ " << p << std::endl;
+#endif
+    m_allocator[i] = BlockAllocator(blockSize[i], slice[i],
+        reinterpret_cast<MemoryBlock *>(p), state);
+    state += BlockAllocator::stateWords(slice[i] / blockSize[i], blockSize[i]);
+    offset += slice[i];
+    m_sliceEnd[j] = offset;
+  }
+
+  m_heapBytes = offset;
+
+  // Record the slice holding the start of every granule
+  size_t slicePos = 0;
+  for (size_t g = 0; (g << m_granuleShift) < m_heapBytes; ++g)
+  {
+    while (m_sliceEnd[slicePos] <= (g << m_granuleShift))
+    {
+      ++slicePos;
+    }
+    m_granuleSlice[g] = static_cast<uint8_t>(slicePos);
+  }
+
+  // Map every size class to the first allocator that can serve it; classes
+  // too large to compute are served by none
+  size_t a = 0;
+  for (size_t k = 0; k < CLASS_LOOKUP_SIZE; ++k)
+  {
+    while ((a < m_nAllocators) &&
+           (((k >> CLASS_STEP_BITS) >= SIZE_BITS - 1) ||
+               (m_allocator[a].getBlockSize() < classSize(k))))
+    {
+      ++a;
+    }
+    m_classIndex[k] = static_cast<uint8_t>(a);
+  }
+
+  ThreadCacheTable::registerPool(m_registration);
+  m_initialized = true;
+
+  if (config.trimInterval && m_trimPage)
+  {
+    m_trimThread =
+        std::thread(&MemoryPool::trimLoop, this, config.trimInterval);
+  }
+}
+
+MemoryPool::~MemoryPool()
+{
+  if (m_trimThread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_trimLock);
+      m_trimStop = true;
+    }
+    m_trimWake.notify_one();
+    m_trimThread.join();
+  }
+
+  // Once unregistered no thread cache will return blocks to this pool
+  ThreadCacheTable::unregisterPool(m_registration);
+  delete m_sampler.load(std::memory_order_acquire);
+
+  // Allocations die with the pool, including those served by malloc
+  for (auto p : m_overflowBlocks)
+  {
+    std::free(const_cast<void *>(p));
+  }
+
+#ifdef POOL_STATIC_HEAP
+  if (m_heap == s_pool_heap)
+  {
+    for (auto &word : s_pool_state)
+    {
+      word.store(0, std::memory_order_relaxed);
+    }
+    s_pool_heap_used = false;
+  }
+#endif
+}
+
+ThreadCache &MemoryPool::threadCache()
+{
+  return t_caches.get(m_registration.m_id, m_allocator, m_nAllocators);
+}
+
+bool MemoryPool::planSlices(const size_t *blockSize,
+    const size_t *budget,
+    const size_t heapBytes,
+    size_t *slice)
+{
+  const size_t nSizes = m_nAllocators;
+
+  // Budgeted block sizes take their bytes off the top
+  size_t reserved = 0;
+  size_t nShared = 0;
+  for (size_t i = 0; i < nSizes; ++i)
+  {
+    reserved += budget[i];
+    nShared += budget[i] ? 0 : 1;
+  }
+  if (reserved > heapBytes)
+  {
+#ifdef DEBUG
+    std::cerr << " !! Budgets of " << reserved << " bytes exceed the heap of "
+              << heapBytes << " bytes!" << std::endl;
+#endif
+    return false;
+  }
+
+  // The rest share what remains equally, in whole blocks
+  size_t share = nShared ? (heapBytes - reserved) / nShared : 0;
   for (size_t i = 0; i < nSizes; ++i)
   {
-    // Assumption: because number of block sizes provided is assumed to be a
-    // power of two, this division will always result in equally sized
-    // mini-heaps
-    void *p = &s_pool_heap[i * POOLSIZE_BYTES / nSizes];
+    slice[i] = budget[i] ? budget[i] : (share / blockSize[i]) * blockSize[i];
+
+    // Ensure every block size gets at least one block
+    if (slice[i] < blockSize[i])
+    {
 #ifdef DEBUG
-    std::cout << " ** Block[" << i << "]: size = " << blockSize[i] << " @ " << p
+      std::cerr << " !! Block size [" << i << "]: " << blockSize[i]
+                << " is larger than its share of the heap (" << slice[i]
+                << ")!" << std::endl;
+#endif
+      return false;
+    }
+
+    // Ensure each allocator slice can be addressed by its free list
+    if (slice[i] > BlockAllocator::MAX_BYTES)
+    {
+#ifdef DEBUG
+      std::cerr << " !! Heap slice " << slice[i] << " larger than the maximum "
+                << BlockAllocator::MAX_BYTES << "!" << std::endl;
+#endif
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool MemoryPool::setupHeap(const PoolConfig &config,
+    const size_t heapBytes,
+    const size_t *blockSize,
+    const size_t *budget,
+    size_t *slice,
+    std::atomic<uint64_t> *&state)
+{
+  const size_t nSizes = m_nAllocators;
+  if (!planSlices(blockSize, budget, heapBytes, slice))
+  {
+    return false;
+  }
+
+  // Size the heap of every allocator
+  size_t carved = 0;
+  for (size_t i = 0; i < nSizes; ++i)
+  {
+    carved += slice[i];
+  }
+  size_t stateSize = stateBytes(blockSize, slice);
+
+  if (config.heapMemory)
+  {
+    // Carve the allocation state from the end of the caller's memory and
+    // shrink the slices to fit in front of it. Smaller slices may need a
+    // finer granule table, so repeat until both fit.
+    size_t usable = heapBytes;
+    while (carved + stateSize > heapBytes)
+    {
+      usable = (heapBytes > stateSize)
+                   ? (heapBytes - stateSize) & ~(sizeof(uint64_t) - 1)
+                   : 0;
+      if (!usable || !planSlices(blockSize, budget, usable, slice))
+      {
+#ifdef DEBUG
+        std::cerr << " !! Heap of " << heapBytes
+                  << " bytes too small for its bitmaps!" << std::endl;
+#endif
+        return false;
+      }
+      carved = 0;
+      for (size_t i = 0; i < nSizes; ++i)
+      {
+        carved += slice[i];
+      }
+      stateSize = stateBytes(blockSize, slice);
+    }
+    usable = (heapBytes - stateSize) & ~(sizeof(uint64_t) - 1);
+
+    m_heap = static_cast<uint8_t *>(config.heapMemory);
+    state = reinterpret_cast<std::atomic<uint64_t> *>(m_heap + usable);
+    memset(static_cast<void *>(state), 0, stateSize);
+    setupGranules(blockSize, slice, state);
+    // The pool does not own the caller's pages (which may be file backed or
+    // hold data the caller still needs), so it never trims them
+    m_heapZeroed = false;
+    return true;
+  }
+
+#ifdef POOL_STATIC_HEAP
+  // The static heap has a fixed size and can only back one pool at a time
+  if (heapBytes > POOLSIZE_BYTES)
+  {
+#ifdef DEBUG
+    std::cerr << " !! Heap size " << heapBytes
+              << " larger than the static heap " << POOLSIZE_BYTES << "!"
               << std::endl;
 #endif
-    m_allocator[i] = BlockAllocator(blockSize[i], POOLSIZE_BYTES / nSizes,
-        reinterpret_cast<MemoryBlock *>(p));
+    return false;
   }
+  if (s_pool_heap_used.exchange(true))
+  {
+#ifdef DEBUG
+    std::cerr << " !! Static heap already in use!" << std::endl;
+#endif
+    return false;
+  }
+  m_heap = s_pool_heap;
+  state = s_pool_state;
+  // Only the first pool finds the static heap zero filled
+  m_heapZeroed = !s_pool_heap_dirty.exchange(true);
+#else
+  if (!m_heapRegion.map(carved, config.heapFlags) ||
+      !m_stateRegion.map(stateSize))
+  {
+    return false;
+  }
+  // Place the pages before the free lists first touch them
+  if (config.numaNode >= 0)
+  {
+    m_heapRegion.bindNode(config.numaNode);
+    m_stateRegion.bindNode(config.numaNode);
+  }
+  // Freshly mapped memory is zero filled, which is a valid, all free state
+  m_heap = m_heapRegion.data();
+  m_heapZeroed = true;
+  state = reinterpret_cast<std::atomic<uint64_t> *>(m_stateRegion.data());
+  // Explicit huge pages are reserved up front, so trimming them gains nothing
+  m_trimPage = m_heapRegion.isHugeTlb() ? 0 : sysconf(_SC_PAGESIZE);
+#endif
+  setupGranules(blockSize, slice, state);
 
-  m_nAllocators = nSizes;
-  m_initialized = true;
+  return true;
 }
 
-bool MemoryPool::scrubBlockSizes(const size_t *blockSize, const size_t nSizes)
+size_t MemoryPool::granuleShift(const size_t *slice)
 {
-  // 1. Ensure that number of block sizes is a power of 2
-  if (!isPower2(nSizes))
+  size_t smallest = slice[0];
+  for (size_t i = 1; i < m_nAllocators; ++i)
+  {
+    smallest = (slice[i] < smallest) ? slice[i] : smallest;
+  }
+  return SIZE_BITS - 1 - __builtin_clzll(smallest);
+}
+
+size_t MemoryPool::stateBytes(const size_t *blockSize, const size_t *slice)
+{
+  // The bitmaps of every allocator, then one byte per granule of the heap
+  size_t words = 0;
+  size_t carved = 0;
+  for (size_t i = 0; i < m_nAllocators; ++i)
+  {
+    words += BlockAllocator::stateWords(slice[i] / blockSize[i], blockSize[i]);
+    carved += slice[i];
+  }
+  size_t granules = ((carved - 1) >> granuleShift(slice)) + 1;
+  return (words + (granules + sizeof(uint64_t) - 1) / sizeof(uint64_t)) *
+         sizeof(uint64_t);
+}
+
+void MemoryPool::setupGranules(const size_t *blockSize,
+    const size_t *slice,
+    std::atomic<uint64_t> *state)
+{
+  size_t words = 0;
+  for (size_t i = 0; i < m_nAllocators; ++i)
+  {
+    words += BlockAllocator::stateWords(slice[i] / blockSize[i], blockSize[i]);
+  }
+  m_granuleSlice = reinterpret_cast<uint8_t *>(state + words);
+  m_granuleShift = granuleShift(slice);
+}
+
+bool MemoryPool::scrubBlockSizes(const PoolConfig &config)
+{
+  const size_t *blockSize = config.blockSizes;
+  const size_t nSizes = config.nSizes;
+
+  // 1. Ensure that at least one block size is given
+  if (!blockSize || (0 == nSizes))
   {
 #ifdef DEBUG
-    std::cerr << " !! Number of block sizes " << nSizes
-              << " is not a power of 2!" << std::endl;
+    std::cerr << " !! No block sizes given!" << std::endl;
 #endif
     m_initialized = false;
     return false;
@@ -130,39 +1072,51 @@ bool MemoryPool::scrubBlockSizes(const size_t *blockSize, const size_t nSizes)
     return false;
   }
 
-  size_t bytesPerPool = POOLSIZE_BYTES / nSizes;
   for (size_t i = 0; i < nSizes; ++i)
   {
-    // 3. Ensure that all block sizes are a power of 2
-    if (!isPower2(blockSize[i]))
+    // 3. Ensure that all block sizes are size classes
+    if (!isSizeClass(blockSize[i]))
     {
 #ifdef DEBUG
       std::cerr << " !! Block size [" << i << "]: " << blockSize[i]
-                << " is not a power of 2!" << std::endl;
+                << " is not a size class!" << std::endl;
 #endif
       m_initialized = false;
       return false;
     }
 
-    // 4. Ensure all block sizes are valid given sizes and count
-    if (blockSize[i] > bytesPerPool)
+    // 4. Ensure that block sizes are larger that smallest memory block
+    if (blockSize[i] < sizeof(MemoryBlock *))
     {
 #ifdef DEBUG
       std::cerr << " !! Block size [" << i << "]: " << blockSize[i]
-                << " is larger than available bytes per pool (" << bytesPerPool
+                << " is less than minimum block size (" << sizeof(MemoryBlock *)
                 << ")!" << std::endl;
 #endif
       m_initialized = false;
       return false;
     }
 
-    // 5. Ensure that block sizes are larger that smallest memory block
-    if (blockSize[i] < sizeof(MemoryBlock *))
+    // 5. Ensure a block count can be addressed by the allocator's free list
+    if (config.blockCounts &&
+        (config.blockCounts[i] > BlockAllocator::MAX_BYTES / blockSize[i]))
     {
 #ifdef DEBUG
-      std::cerr << " !! Block size [" << i << "]: " << blockSize[i]
-                << " is less than minimum block size (" << sizeof(MemoryBlock *)
-                << ")!" << std::endl;
+      std::cerr << " !! Block count [" << i << "]: " << config.blockCounts[i]
+                << " is larger than the maximum!" << std::endl;
+#endif
+      m_initialized = false;
+      return false;
+    }
+
+    // 6. Ensure a byte budget holds at least one block
+    if (config.byteBudgets && config.byteBudgets[i] &&
+        (config.byteBudgets[i] < blockSize[i]))
+    {
+#ifdef DEBUG
+      std::cerr << " !! Byte budget [" << i << "]: " << config.byteBudgets[i]
+                << " is less than its block size (" << blockSize[i] << ")!"
+                << std::endl;
 #endif
       m_initialized = false;
       return false;
@@ -172,6 +1126,65 @@ bool MemoryPool::scrubBlockSizes(const size_t *blockSize, const size_t nSizes)
   return true;
 }
 
+bool MemoryPool::setupOverflow(const PoolConfig &config)
+{
+  // Secondary pools serve requests of any size, so a request never needs to
+  // borrow from a larger block size under them
+  switch (config.overflow)
+  {
+  case PoolConfig::OVERFLOW_BORROW:
+    m_borrowSpan = config.borrowLimit ? config.borrowLimit : BLKCNT_MAX;
+    break;
+  case PoolConfig::OVERFLOW_HEAP:
+    if (!config.overflowHeap || (config.overflowHeap == this))
+    {
+#ifdef DEBUG
+      std::cerr << " !! Overflow heap missing!" << std::endl;
+#endif
+      return false;
+    }
+    m_borrowSpan = 0;
+    break;
+  case PoolConfig::OVERFLOW_FAIL:
+  case PoolConfig::OVERFLOW_MALLOC:
+    m_borrowSpan = 0;
+    break;
+  default:
+#ifdef DEBUG
+    std::cerr << " !! Unknown overflow policy " << config.overflow << "!"
+              << std::endl;
+#endif
+    return false;
+  }
+
+  m_overflow = config.overflow;
+  m_overflowHeap = config.overflowHeap;
+  return true;
+}
+
+bool MemoryPool::setupTrim(const PoolConfig &config)
+{
+  switch (config.trim)
+  {
+  case PoolConfig::TRIM_DONTNEED:
+    m_trimAdvice = MADV_DONTNEED;
+    break;
+  case PoolConfig::TRIM_FREE:
+#ifdef MADV_FREE
+    m_trimAdvice = MADV_FREE;
+#else
+    m_trimAdvice = MADV_DONTNEED;
+#endif
+    break;
+  default:
+#ifdef DEBUG
+    std::cerr << " !! Unknown trim policy " << config.trim << "!" << std::endl;
+#endif
+    return false;
+  }
+  return true;
+}
+
 bool MemoryPool::isPower2(size_t num)
 {
   // Handle special case of 0
@@ -193,10 +1206,21 @@ bool MemoryPool::isPower2(size_t num)
   return true;
 }
 
-void MemoryPool::sortArray(size_t *array, const size_t nElements)
+bool MemoryPool::isSizeClass(size_t num)
+{
+  // Powers of 2 are always accepted; other sizes must be the top of a size
+  // class and keep every block CLASS_ALIGN aligned
+  return isPower2(num) ||
+         ((0 == (num % CLASS_ALIGN)) && (num == classSize(sizeClass(num))));
+}
+
+void MemoryPool::sortArray(size_t *array,
+    size_t *companion,
+    const size_t nElements)
 {
-  // An inefficient sort for general cases, but this is called at most once and
-  // on an array of at most BLKCNT_MAX elements
+  // An inefficient sort for general cases, but this is called once per pool
+  // and on an array of at most BLKCNT_MAX elements. Companion entries move
+  // along with their array entries.
   for (size_t i = 0; i < nElements; i++)
   {
     for (size_t j = 0; j < nElements - 1; j++)
@@ -206,6 +1230,9 @@ void MemoryPool::sortArray(size_t *array, const size_t nElements)
         size_t temp = array[i];
         array[i] = array[j];
         array[j] = temp;
+        temp = companion[i];
+        companion[i] = companion[j];
+        companion[j] = temp;
       }
     }
   }
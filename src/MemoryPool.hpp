@@ -1,6 +1,169 @@
+#pragma once
+
 #include <cstddef>
 #include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <unordered_set>
 #include "BlockAllocator.hpp"
+#include "PoolHeap.hpp"
+#include "PoolSampler.hpp"
+#include "ThreadCache.hpp"
+
+class MemoryPool;
+
+/**
+ * @struct PoolConfig PoolConfig
+ *
+ * Define the runtime configuration of a memory pool. Fields left at their
+ * default values select the default behavior.
+ */
+struct PoolConfig
+{
+  /** @brief Ways to serve a request once its size class is exhausted */
+  enum Overflow : unsigned
+  {
+    /** @brief Take a block from a larger size class (up to borrowLimit) */
+    OVERFLOW_BORROW = 0,
+    /** @brief Fail the request */
+    OVERFLOW_FAIL = 1,
+    /** @brief Allocate from the secondary pool overflowHeap */
+    OVERFLOW_HEAP = 2,
+    /** @brief Allocate with malloc, tracking the block for release() */
+    OVERFLOW_MALLOC = 3,
+  };
+
+  /** @brief Ways to hand trimmed heap pages back to the operating system */
+  enum Trim : unsigned
+  {
+    /** @brief madvise(MADV_DONTNEED): pages are released at once */
+    TRIM_DONTNEED = 0,
+    /** @brief madvise(MADV_FREE): pages are released under memory pressure */
+    TRIM_FREE = 1,
+  };
+
+  /** @brief Array of block sizes to configure in pool */
+  const size_t *blockSizes{nullptr};
+  /** @brief Number of block sizes in the size array */
+  size_t nSizes{0};
+  /**
+   * @brief Optional number of blocks to carve for each block size, in the
+   * order of blockSizes. A zero entry falls back to byteBudgets.
+   */
+  const size_t *blockCounts{nullptr};
+  /**
+   * @brief Optional number of heap bytes to give each block size, in the
+   * order of blockSizes (rounded down to a whole number of blocks). Block
+   * sizes with neither a count nor a budget share the rest of the heap
+   * equally.
+   */
+  const size_t *byteBudgets{nullptr};
+  /**
+   * @brief Number of bytes in the pool heap (0 selects the default size, or
+   * the sum of the budgets when every block size has one)
+   */
+  size_t heapBytes{0};
+  /** @brief PoolHeap::Flags selecting the pages backing the heap */
+  unsigned heapFlags{PoolHeap::HEAP_DEFAULT};
+  /**
+   * @brief Caller-owned memory of heapBytes bytes to use as the heap instead
+   * of mapping (or, in static builds, the static array). The allocation state
+   * bitmaps are carved from its end. Should be aligned to the largest power of
+   * 2 dividing any block size, and must outlive the pool. The pool never
+   * trims this memory.
+   */
+  void *heapMemory{nullptr};
+  /**
+   * @brief NUMA node to place the mapped heap and bitmaps on (-1 leaves the
+   * placement to the kernel, normally the node of the constructing thread)
+   */
+  int numaNode{-1};
+  /**
+   * @brief Overflow value selecting what happens when a request finds its size
+   * class empty. Only OVERFLOW_HEAP and OVERFLOW_MALLOC also serve requests
+   * larger than the largest block size.
+   */
+  unsigned overflow{OVERFLOW_BORROW};
+  /**
+   * @brief Number of larger block sizes a request may borrow from under
+   * OVERFLOW_BORROW (0 for all of them)
+   */
+  size_t borrowLimit{0};
+  /**
+   * @brief Secondary pool serving requests under OVERFLOW_HEAP. Must outlive
+   * the pool, and must not overflow back into it.
+   */
+  MemoryPool *overflowHeap{nullptr};
+  /** @brief Trim value selecting how MemoryPool::trim() releases pages */
+  unsigned trim{TRIM_DONTNEED};
+  /**
+   * @brief Period in milliseconds of a background thread trimming the pool
+   * whenever blocks were released since its previous pass (0 for none)
+   */
+  unsigned trimInterval{0};
+};
+
+/**
+ * @struct PoolClassStats PoolClassStats
+ *
+ * Define a snapshot of the usage counters of one size class. Counters are
+ * updated without synchronization between them, so a snapshot taken while
+ * other threads allocate is approximate.
+ */
+struct PoolClassStats
+{
+  /** @brief Size of the blocks in the class */
+  size_t blockSize{0};
+  /** @brief Number of blocks carved for the class */
+  size_t blockCount{0};
+  /** @brief Blocks currently handed out (not counting thread caches) */
+  uint64_t inUse{0};
+  /**
+   * @brief Largest number of blocks out of the shared free lists at once,
+   * handed out or held by thread caches
+   */
+  uint64_t highWater{0};
+  /** @brief Blocks handed out since the pool was created */
+  uint64_t allocations{0};
+  /** @brief Blocks released since the pool was created */
+  uint64_t frees{0};
+  /** @brief Requests for the class that no class could serve */
+  uint64_t failures{0};
+  /** @brief Requests for the class served by a larger class */
+  uint64_t fallThroughs{0};
+  /** @brief Requests for the class served by the overflow heap or malloc */
+  uint64_t overflows{0};
+  /** @brief Free list exchanges retried after losing a race */
+  uint64_t contention{0};
+  /** @brief Heap bytes of the class trimmed and not reused since */
+  size_t trimmedBytes{0};
+};
+
+/**
+ * @struct PoolStats PoolStats
+ *
+ * Define a snapshot of the usage counters of a pool (see
+ * MemoryPool::getStats()).
+ */
+struct PoolStats
+{
+  /** @brief Maximum number of size classes in a snapshot */
+  static constexpr size_t CLASS_MAX = 32;
+
+  /** @brief Number of size classes in the pool */
+  size_t nClasses{0};
+  /** @brief Counters of each size class, in ascending block size */
+  PoolClassStats classes[CLASS_MAX];
+  /** @brief Requests larger than the largest block size */
+  uint64_t oversize{0};
+  /** @brief Requests served by the overflow heap or malloc, of any size */
+  uint64_t overflows{0};
+  /** @brief Overflow allocations released back through the pool */
+  uint64_t overflowFrees{0};
+};
 
 /**
  * @class MemoryPool MemoryPool
@@ -11,23 +174,63 @@
  * Assumptions:
  *  - Allocation of more than a single block is not desired, thus ensuring
  *    blocks of contiguous memory are available is not necessary. [simplifying]
- *  - All allocations are equally possible, thus dividing heap into equal
- *    segments and breaking those segments into blocks. [simplyfying]
- *  - All allocation sizes must be a power of 2, as well as the number of block
- *    sizes to allocate to ensure no wasted memory.
+ *  - The heap is divided into one slice per block size and each slice is
+ *    broken into blocks. Slices are sized from the per-size block counts or
+ *    byte budgets in the PoolConfig; sizes without one share the rest of the
+ *    heap equally.
+ *  - A request finding its size class empty is served according to the
+ *    overflow policy of the PoolConfig: by default it borrows a block from
+ *    the next larger size class with one available.
+ *  - Block sizes must be size classes: a power of 2, or a multiple of 16 that
+ *    falls on a quarter step between two powers of 2 (e.g. 80, 96, 112,
+ *    160, 2560). Every block is aligned to the largest power of 2 dividing
+ *    its size, so at least 16 bytes for sizes that are not a power of 2.
+ *
+ * Pools are independent of each other, so separate subsystems can each own a
+ * pool that neither fragments nor contends with the others. A global singleton
+ * is kept as a convenience for applications that only need one.
+ *
+ * The heap is mapped at runtime with the size given in the PoolConfig, optionally
+ * on huge pages, or taken from caller-owned memory. Builds defining
+ * POOL_STATIC_HEAP instead use a statically allocated array of POOLSIZE_BYTES
+ * (for one pool at a time), for systems without a memory manager.
+ *
+ * Each thread keeps a private cache of free blocks per size class (see
+ * ThreadCache) in front of the shared allocators, so the common allocate and
+ * release paths take no lock.
  */
 class MemoryPool
 {
 public:
   /**
-   * @brief MemoryPool is a singleton class - must use getPool() to obtain
-   * instance for use in application code. This ensures that only one instance
-   * of the memory pool ever exists per application.
+   * @brief Construct an independent pool
+   *
+   * @param config Pool configuration; check isInitialized() for success
+   */
+  explicit MemoryPool(const PoolConfig &config);
+  ~MemoryPool();
+
+  // Pools own their heap, so they can be neither copied nor assigned
+  MemoryPool() = delete;
+  MemoryPool &operator=(const MemoryPool &other) = delete;
+  MemoryPool(const MemoryPool &other) = delete;
+
+  /**
+   * @brief Obtain the global pool shared by the whole application, for
+   * applications that only need a single pool. The first call configures it.
    *
    * @return Reference to singleton instance of MemoryPool
    */
   static MemoryPool &getPool(const size_t *blockSize, const size_t nSizes);
 
+  /**
+   * @brief Obtain the singleton instance, configuring it on the first call
+   *
+   * @param config Pool configuration, only used by the first call
+   * @return Reference to singleton instance of MemoryPool
+   */
+  static MemoryPool &getPool(const PoolConfig &config);
+
   /**
    * @brief Return whether pool is initialized and ready to allocate memory
    *
@@ -44,6 +247,34 @@ public:
    */
   void *allocate(size_t n);
 
+  /**
+   * @brief Allocate a block of at least n bytes, its first n bytes zeroed
+   *
+   * Blocks handed out for the first time from a mapped heap (or from the
+   * static heap, by the first pool using it) are known to be zero but for
+   * their free list link, so only that word is cleared. Other blocks are
+   * cleared with memset.
+   *
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to the allocated memory block, or null on failure
+   */
+  void *allocateZeroed(size_t n);
+
+  /**
+   * @brief Allocate a block of at least n bytes aligned to align bytes
+   *
+   * Blocks of a power of 2 size are naturally aligned to their size, so a
+   * request is served by the smallest block size that holds n bytes and whose
+   * blocks have the alignment, without any padding. Alignments up to ALIGN_MAX
+   * are met by every block at least that large.
+   *
+   * @param n Number of bytes to allocate
+   * @param align Alignment, a power of 2
+   * @return void* Pointer to the allocated memory block, or null on failure
+   * (including when no block size has the alignment)
+   */
+  void *allocate(size_t n, size_t align);
+
   /**
    * @brief Release memory allocation pointed to by pointer p back to pool
    *
@@ -51,33 +282,490 @@ public:
    */
   void release(void *p);
 
-private:
-  // Private ctor for proper singleton behavior
-  MemoryPool(const size_t *blockSize, const size_t nSizes);
+  /**
+   * @brief Release memory allocation pointed to by pointer p back to pool,
+   * given the size it was allocated with
+   *
+   * The size names the owning allocator directly, skipping the search by
+   * address; a block that fell through to a larger size class when allocated
+   * takes the general path. Debug builds report a size larger than the block.
+   *
+   * @param[in] p Pointer to memory block to release
+   * @param n Number of bytes requested when the block was allocated
+   */
+  void release(void *p, size_t n);
 
-  // Delete the default ctor, assignment operator, and copy ctor for singleton
-  MemoryPool() = delete;
-  MemoryPool &operator=(const MemoryPool &other) = delete;
-  MemoryPool(const MemoryPool &other) = delete;
+  /**
+   * @brief Resize an allocation, keeping its block whenever possible
+   *
+   * The block stays in place while it holds n bytes, unless a block at most
+   * half its size would do. Otherwise the data moves to a block of the size
+   * class of n, and the old block goes straight back to its allocator. Growing
+   * into the slack of a block (see usableSize()) never moves it.
+   *
+   * @param p Pointer to memory block to resize (nullptr to allocate)
+   * @param n Number of bytes needed (0 to release the block)
+   * @return void* Pointer to the resized allocation, or nullptr on failure (p
+   * is then left untouched) or when n is 0
+   */
+  void *reallocate(void *p, size_t n);
+
+  /**
+   * @brief Allocate up to count blocks of at least n bytes at once
+   *
+   * Each size class drawn from costs a single exchange on its shared free list
+   * rather than one per block. Bulk allocations bypass the thread cache.
+   *
+   * @param n Number of bytes in each block
+   * @param count Number of blocks to allocate
+   * @param[out] out Array receiving the addresses of the blocks
+   * @return size_t Number of blocks allocated, less than count if the pool
+   * runs out
+   */
+  size_t allocateBulk(size_t n, size_t count, void **out);
+
+  /**
+   * @brief Release count memory allocations back to pool at once
+   *
+   * Blocks are gathered into one chain per size class, each spliced onto its
+   * shared free list with a single exchange. Pointers that are not in-use
+   * blocks of this pool are skipped, as with release().
+   *
+   * @param[in] p Array of pointers to the memory blocks to release
+   * @param count Number of pointers in the array
+   */
+  void releaseBulk(void **p, size_t count);
+
+  /**
+   * @brief Take a snapshot of the usage counters of every size class
+   *
+   * The counters are always on and cost a relaxed atomic increment per
+   * allocation or release (plus a compare for the high-water mark).
+   *
+   * @return PoolStats Snapshot of the counters
+   */
+  PoolStats getStats();
+
+  /**
+   * @brief Return heap pages holding only free blocks to the operating system
+   *
+   * The calling thread's cache is flushed first; blocks cached by other
+   * threads keep their pages resident. Trimmed pages are reused last, only
+   * once a size class has no other free block, and are faulted back in as
+   * their blocks are handed out. Only heaps the pool mapped itself are
+   * trimmed: pools on caller memory, on the static heap or on explicit huge
+   * pages never are.
+   *
+   * @return size_t Heap bytes returned to the operating system by this call;
+   * pages still trimmed by earlier calls are skipped, and are counted in
+   * PoolClassStats::trimmedBytes instead
+   */
+  size_t trim();
+
+  /**
+   * @brief Set the number of free blocks each thread may cache per size class
+   *
+   * Bins are refilled from and flushed to the shared allocators in batches of
+   * half this depth. A depth of zero effectively disables caching, with every
+   * allocation and release going straight to the shared allocators.
+   *
+   * @param depth Maximum number of cached blocks per size class per thread
+   */
+  void setCacheDepth(size_t depth) { m_cacheDepth = depth; }
+
+  /**
+   * @brief Get the number of free blocks each thread may cache per size class
+   *
+   * @return size_t Current per-thread cache depth
+   */
+  size_t getCacheDepth() { return m_cacheDepth; }
+
+  /**
+   * @brief Sample one in about every bytes bytes allocated, recording the
+   * size class and call stack of each sampled allocation until its block is
+   * released
+   *
+   * While sampling has never been enabled, allocations and releases pay a
+   * single branch for it. The rate applies to every thread from its next
+   * allocation; samples already taken stay until released, even once
+   * sampling is disabled again.
+   *
+   * @param bytes Mean number of bytes allocated between samples (0 disables
+   * sampling)
+   * @return true Sampling rate set
+   * @return false The sampler could not be created
+   */
+  bool setSampleRate(size_t bytes);
+
+  /**
+   * @brief Get the mean number of bytes allocated between samples
+   *
+   * @return size_t Sampling rate, or 0 if sampling is disabled
+   */
+  size_t getSampleRate() { return m_sampleRate; }
+
+  /**
+   * @brief Write the sampled allocations still live
+   *
+   * @param out Stream receiving the samples
+   * @param format PoolSampler::Format of the dump
+   * @return size_t Number of live samples written (nothing is written while
+   * sampling has never been enabled)
+   */
+  size_t dumpSamples(std::ostream &out, unsigned format);
+
+  /**
+   * @brief Get the number of bytes of heap carved into blocks
+   *
+   * @return size_t Number of bytes managed by the pool
+   */
+  size_t getHeapSize() { return m_heapBytes; }
+
+  /**
+   * @brief Determine if an address lies within the pool heap
+   *
+   * @param p Address to check
+   * @return true Address belongs to the pool
+   * @return false Address belongs to some other memory
+   */
+  bool owns(const void *p)
+  {
+    return (reinterpret_cast<uintptr_t>(p) -
+               reinterpret_cast<uintptr_t>(m_heap)) < m_heapBytes;
+  }
+
+  /**
+   * @brief Get the number of bytes usable in an allocation, the size of the
+   * block holding it
+   *
+   * @param p Address returned by allocate()
+   * @return size_t Block size, or 0 if the address is neither in the pool heap
+   * nor an overflow allocation
+   */
+  size_t usableSize(const void *p)
+  {
+    size_t offset = reinterpret_cast<uintptr_t>(p) -
+                    reinterpret_cast<uintptr_t>(m_heap);
+    return (offset < m_heapBytes)
+               ? m_allocator[allocatorOf(offset)].getBlockSize()
+               : overflowSize(p);
+  }
+
+  /**
+   * @brief Determine if an address was served by the overflow of the pool
+   * (the overflow heap or malloc) and not yet released
+   *
+   * @param p Address to check
+   * @return true Address must be released through this pool
+   * @return false Address belongs to the pool heap or some other memory
+   */
+  bool isOverflow(const void *p);
+
+  /**
+   * @brief Largest alignment the pool guarantees: a block of at least
+   * ALIGN_MAX bytes is ALIGN_MAX aligned, and a smaller block is aligned to
+   * its size
+   */
+  static constexpr size_t ALIGN_MAX = 16;
+
+  /** @brief Maximum number of block pools available for initialization/use */
+  static constexpr uint8_t BLKCNT_MAX = 32;
+
+private:
+  /**
+   * @brief Allocate a block of at least n bytes, reporting whether it was
+   * carved fresh and never handed out before
+   */
+  void *allocateBlock(size_t n, bool &carved);
 
   // Helper routines for pool initialization
-  bool scrubBlockSizes(const size_t *blockSize, const size_t nSizes);
+  bool scrubBlockSizes(const PoolConfig &config);
+  bool setupOverflow(const PoolConfig &config);
+  bool setupTrim(const PoolConfig &config);
   bool isPower2(size_t val);
-  void sortArray(size_t *array, const size_t nElements);
+  bool isSizeClass(size_t val);
+  void sortArray(size_t *array, size_t *companion, const size_t nElements);
+  bool planSlices(const size_t *blockSize,
+      const size_t *budget,
+      const size_t heapBytes,
+      size_t *slice);
+  size_t granuleShift(const size_t *slice);
+  size_t stateBytes(const size_t *blockSize, const size_t *slice);
+  void setupGranules(const size_t *blockSize,
+      const size_t *slice,
+      std::atomic<uint64_t> *state);
+  bool setupHeap(const PoolConfig &config,
+      const size_t heapBytes,
+      const size_t *blockSize,
+      const size_t *budget,
+      size_t *slice,
+      std::atomic<uint64_t> *&state);
+
+  /**
+   * @brief Find the allocator owning a heap offset
+   *
+   * @param offset Offset into the heap, less than m_heapBytes
+   * @return size_t Index of the allocator whose slice holds the offset
+   */
+  size_t allocatorOf(size_t offset)
+  {
+    // No granule is larger than the smallest slice, so at most one slice
+    // ends inside it: the offset lies in the slice holding the start of its
+    // granule or in the next one
+    size_t slice = m_granuleSlice[offset >> m_granuleShift];
+    slice += (offset >= m_sliceEnd[slice]);
+    return m_sliceOwner[slice];
+  }
+
+  /**
+   * @brief Serve a request for class first, which the heap could not serve,
+   * according to the overflow policy
+   *
+   * @return void* Overflow allocation, or nullptr if there is no overflow or
+   * it is exhausted too
+   */
+  void *allocateOverflow(size_t n, size_t align, size_t first);
+
+  /**
+   * @brief Release an address outside the heap if it was served by the
+   * overflow
+   *
+   * @return true Address was released
+   * @return false Address is not an overflow allocation of this pool
+   */
+  bool releaseOverflow(void *p);
+
+  /**
+   * @brief Get the usable size of an address outside the heap
+   *
+   * @return size_t Usable bytes of an overflow allocation, or 0 if the
+   * address is not one
+   */
+  size_t overflowSize(const void *p);
+
+  /**
+   * @brief Release a block to allocator i, the one owning it
+   *
+   * @return true Block released
+   * @return false Address is not an in-use block of the allocator
+   */
+  bool releaseTo(size_t i, void *p);
+
+  /**
+   * @brief Record an allocation of n bytes at p once enough bytes were
+   * allocated since the last sample
+   */
+  void sample(void *p, size_t n);
 
-  /** @brief Total number of bytes in the memory pool */
+  /**
+   * @brief Drop the sample of a block being released, if sampling was ever
+   * enabled
+   */
+  void unsample(const void *p);
+
+  /**
+   * @brief Body of the background trim thread, trimming every interval
+   * milliseconds until the pool is destroyed
+   */
+  void trimLoop(unsigned interval);
+
+  /**
+   * @brief Count blocks handed out by allocator i for a request for class
+   * first, in the calling thread's cache
+   */
+  void countAllocations(ThreadCache &cache, size_t first, size_t i, uint64_t n)
+  {
+    cache.countAllocations(i, n);
+    if (i != first)
+    {
+      m_counters[first].m_fallThroughs.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Count blocks of a request for class first that could not be served
+   */
+  void countFailures(size_t first, uint64_t n);
+
+  /**
+   * @brief Get the calling thread's cache for this pool
+   */
+  ThreadCache &threadCache();
+
+  /**
+   * @brief Map a request size to its size class
+   *
+   * Size classes split every doubling into CLASS_STEPS equal steps (e.g. 64,
+   * 80, 96, 112, 128), so the class is the exponent of the highest set bit of
+   * n - 1 followed by the next CLASS_STEP_BITS bits below it.
+   *
+   * @param n Number of bytes requested
+   * @return size_t Index of the smallest class holding n bytes
+   */
+  static size_t sizeClass(size_t n)
+  {
+    // Requests up to the smallest block share its class
+    n = (n < sizeof(MemoryBlock)) ? sizeof(MemoryBlock) : n;
+    size_t e = SIZE_BITS - 1 - __builtin_clzll(n - 1);
+    return (e << CLASS_STEP_BITS) +
+           (((n - 1) >> (e - CLASS_STEP_BITS)) & (CLASS_STEPS - 1));
+  }
+
+  /**
+   * @brief Get the largest request size in a size class
+   *
+   * @param k Size class index
+   * @return size_t Number of bytes, or 0 for classes below the smallest block
+   */
+  static size_t classSize(size_t k)
+  {
+    size_t e = k >> CLASS_STEP_BITS;
+    return (e < CLASS_STEP_BITS)
+               ? 0
+               : (CLASS_STEPS + 1 + (k & (CLASS_STEPS - 1)))
+                     << (e - CLASS_STEP_BITS);
+  }
+
+  /**
+   * @brief Get the alignment of the blocks of a size, the largest power of 2
+   * dividing it
+   */
+  static size_t blockAlign(size_t size) { return size & (~size + 1); }
+
+  /**
+   * @brief Get the alignment every block of allocator i has, bounded by the
+   * alignment of the start of its slice
+   */
+  size_t allocatorAlign(size_t i)
+  {
+    return blockAlign(
+        reinterpret_cast<uintptr_t>(m_allocator[i].getStartAddress()) |
+        m_allocator[i].getBlockSize());
+  }
+
+  /** @brief Default (and static build) number of bytes in the memory pool */
   static constexpr uint32_t POOLSIZE_BYTES = 65536;
-  /** @brief Maximum number of block pools available for initialization/use */
-  static constexpr uint8_t BLKCNT_MAX = 16;
+  /** @brief Number of bits in a request size */
+  static constexpr size_t SIZE_BITS = sizeof(unsigned long long) * 8;
+  /** @brief log2 of the number of size classes per doubling */
+  static constexpr size_t CLASS_STEP_BITS = 2;
+  /** @brief Number of size classes per doubling */
+  static constexpr size_t CLASS_STEPS = size_t(1) << CLASS_STEP_BITS;
+  /** @brief Alignment every block size that is not a power of 2 must have */
+  static constexpr size_t CLASS_ALIGN = ALIGN_MAX;
+  /** @brief Number of entries in the size class lookup table */
+  static constexpr size_t CLASS_LOOKUP_SIZE = SIZE_BITS << CLASS_STEP_BITS;
+  /** @brief Default number of blocks cached per size class per thread */
+  static constexpr size_t CACHE_DEPTH_DEFAULT = 16;
+  static_assert(BLKCNT_MAX <= ThreadCache::BIN_MAX,
+      "Thread cache must provide a bin for every allocator");
+  static_assert(BLKCNT_MAX <= PoolStats::CLASS_MAX,
+      "Statistics must provide counters for every allocator");
 
-  /** @brief Statically allocated heap used as pool memory */
-  static uint8_t s_pool_heap[POOLSIZE_BYTES];
+  /**
+   * @brief Usage counters of one size class kept off the fast path, on a
+   * cache line of its own (allocations and releases are counted by the thread
+   * caches)
+   */
+  struct alignas(64) ClassCounters
+  {
+    /** @brief Requests for the class that no class could serve */
+    std::atomic<uint64_t> m_failures{0};
+    /** @brief Requests for the class served by a larger class */
+    std::atomic<uint64_t> m_fallThroughs{0};
+    /** @brief Requests for the class served by the overflow */
+    std::atomic<uint64_t> m_overflows{0};
+  };
+
+  /** @brief Number of state words covering the bitmaps and granule table of
+   * the smallest blocks */
+  static constexpr size_t STATE_WORDS =
+      BlockAllocator::stateWords(
+          POOLSIZE_BYTES / sizeof(MemoryBlock), sizeof(MemoryBlock)) +
+      3 * BLKCNT_MAX +
+      POOLSIZE_BYTES / sizeof(MemoryBlock) / sizeof(uint64_t);
+
+#ifdef POOL_STATIC_HEAP
+  /** @brief Statically allocated heap used as pool memory, page aligned like
+   * a mapped heap so blocks keep their alignment */
+  alignas(4096) static uint8_t s_pool_heap[POOLSIZE_BYTES];
+  /** @brief Statically allocated allocation state bitmaps for the heap */
+  static std::atomic<uint64_t> s_pool_state[STATE_WORDS];
+  /** @brief Flag denoting whether a pool is using the static heap */
+  static std::atomic<bool> s_pool_heap_used;
+  /** @brief Flag denoting whether a pool has ever used the static heap */
+  static std::atomic<bool> s_pool_heap_dirty;
+#else
+  /** @brief Mapped region used as pool memory */
+  PoolHeap m_heapRegion;
+  /** @brief Mapped region holding the allocation state bitmaps */
+  PoolHeap m_stateRegion;
+#endif
+  /** @brief Start of the heap used as pool memory */
+  uint8_t *m_heap{nullptr};
+  /** @brief Number of heap bytes divided among the allocators */
+  size_t m_heapBytes{0};
+  /** @brief Flag denoting the heap was zero filled when the pool was built */
+  bool m_heapZeroed{false};
   /** @brief Array of allocators available for use */
   BlockAllocator m_allocator[BLKCNT_MAX];
   /** @brief Flag denoting whether pool has been initialized or not */
   bool m_initialized{false};
-  /** @brief Size of each pool (used to find allocator to use for release) */
-  size_t m_poolSize{0};
+  /**
+   * @brief Heap offset where each slice ends, in heap order (used to find
+   * allocator to use for release)
+   */
+  size_t m_sliceEnd[BLKCNT_MAX]{};
+  /** @brief Index of the allocator owning each slice, in heap order */
+  uint8_t m_sliceOwner[BLKCNT_MAX]{};
+  /**
+   * @brief Position in heap order of the slice holding the start of each
+   * granule of the heap, kept after the allocation state bitmaps
+   */
+  uint8_t *m_granuleSlice{nullptr};
+  /** @brief log2 of the granule size, the largest power of 2 no larger than
+   * the smallest slice */
+  size_t m_granuleShift{0};
   /** @brief Number of pool allocators initialized */
   size_t m_nAllocators{0};
+  /** @brief Index of the first allocator able to serve each size class */
+  uint8_t m_classIndex[CLASS_LOOKUP_SIZE]{};
+  /** @brief Usage counters of each size class */
+  ClassCounters m_counters[BLKCNT_MAX];
+  /** @brief Requests larger than the largest block size */
+  std::atomic<uint64_t> m_oversize{0};
+  /** @brief Requests served by the overflow */
+  std::atomic<uint64_t> m_overflows{0};
+  /** @brief Overflow allocations released */
+  std::atomic<uint64_t> m_overflowFrees{0};
+  /** @brief PoolConfig::Overflow policy for exhausted size classes */
+  unsigned m_overflow{PoolConfig::OVERFLOW_BORROW};
+  /** @brief Number of larger allocators a request may borrow from */
+  size_t m_borrowSpan{BLKCNT_MAX};
+  /** @brief Secondary pool serving OVERFLOW_HEAP requests */
+  MemoryPool *m_overflowHeap{nullptr};
+  /** @brief Blocks handed out by malloc under OVERFLOW_MALLOC */
+  std::unordered_set<const void *> m_overflowBlocks;
+  /** @brief Lock guarding m_overflowBlocks */
+  std::mutex m_overflowLock;
+  /** @brief Page size used to trim the heap (0 when it cannot be trimmed) */
+  size_t m_trimPage{0};
+  /** @brief madvise() advice releasing trimmed pages */
+  int m_trimAdvice{0};
+  /** @brief Background thread trimming the heap, if configured */
+  std::thread m_trimThread;
+  /** @brief Lock guarding m_trimStop */
+  std::mutex m_trimLock;
+  /** @brief Wakes the trim thread when the pool is destroyed */
+  std::condition_variable m_trimWake;
+  /** @brief Flag telling the trim thread to exit */
+  bool m_trimStop{false};
+  /** @brief Per-thread cache depth (blocks per size class) */
+  std::atomic<size_t> m_cacheDepth{CACHE_DEPTH_DEFAULT};
+  /** @brief Mean number of bytes allocated between samples (0 for none) */
+  std::atomic<size_t> m_sampleRate{0};
+  /** @brief Sampler holding the live samples, created when first enabled */
+  std::atomic<PoolSampler *> m_sampler{nullptr};
+  /** @brief Entry in the registry of live pools, holding the pool identifier */
+  PoolRegistration m_registration;
 };
\ No newline at end of file
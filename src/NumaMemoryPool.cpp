@@ -0,0 +1,168 @@
+#include "NumaMemoryPool.hpp"
+
+#include <cstdio>
+#include <new>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+/** @brief Node of the calling thread, refreshed every NODE_REFRESH reads */
+struct ThreadNode
+{
+  /** @brief Node fixed by setThreadNode(), or -1 */
+  int m_fixed{-1};
+  /** @brief Node last reported by the kernel */
+  unsigned m_node{0};
+  /** @brief Reads left before asking the kernel again */
+  unsigned m_countdown{0};
+};
+
+static thread_local ThreadNode t_node;
+
+NumaMemoryPool::NumaMemoryPool(const PoolConfig &config, unsigned nNodes)
+{
+  unsigned machineNodes = detectNodes();
+  m_nNodes = nNodes ? nNodes : machineNodes;
+  m_nNodes = (m_nNodes > NODE_MAX) ? NODE_MAX : m_nNodes;
+
+  // Caller memory cannot be split across nodes
+  if (config.heapMemory && (m_nNodes > 1))
+  {
+#ifdef DEBUG
+    std::cerr << " !! Caller memory cannot back " << m_nNodes << " nodes!"
+              << std::endl;
+#endif
+    return;
+  }
+
+  m_initialized = true;
+  for (unsigned node = 0; node < m_nNodes; ++node)
+  {
+    // Nodes beyond those of the machine get a pool placed by the kernel
+    PoolConfig c = config;
+    c.numaNode = (node < machineNodes) ? static_cast<int>(node) : -1;
+    m_pool[node] = new (std::nothrow) MemoryPool(c);
+    m_initialized = m_initialized && m_pool[node] &&
+                    m_pool[node]->isInitialized();
+  }
+
+#ifdef DEBUG
+  std::cout << " ** NUMA pool with " << m_nNodes << " nodes ("
+            << machineNodes << " on the machine)" << std::endl;
+#endif
+}
+
+NumaMemoryPool::~NumaMemoryPool()
+{
+  for (unsigned node = 0; node < m_nNodes; ++node)
+  {
+    delete m_pool[node];
+  }
+}
+
+void *NumaMemoryPool::allocate(size_t n)
+{
+  void *block = nullptr;
+  if (!m_initialized)
+  {
+    return block;
+  }
+
+  // Start at the calling thread's node and spill over to the next nodes
+  unsigned home = threadNode() % m_nNodes;
+  for (unsigned k = 0; !block && (k < m_nNodes); ++k)
+  {
+    block = m_pool[(home + k) % m_nNodes]->allocate(n);
+  }
+  return block;
+}
+
+void NumaMemoryPool::release(void *p)
+{
+  int node = nodeOf(p);
+  if (node >= 0)
+  {
+    m_pool[node]->release(p);
+  }
+}
+
+void NumaMemoryPool::release(void *p, size_t n)
+{
+  int node = nodeOf(p);
+  if (node >= 0)
+  {
+    m_pool[node]->release(p, n);
+  }
+}
+
+int NumaMemoryPool::nodeOf(const void *p)
+{
+  for (unsigned node = 0; node < m_nNodes; ++node)
+  {
+    if (m_pool[node] &&
+        (m_pool[node]->owns(p) || m_pool[node]->isOverflow(p)))
+    {
+      return static_cast<int>(node);
+    }
+  }
+  return -1;
+}
+
+unsigned NumaMemoryPool::threadNode()
+{
+  if (t_node.m_fixed >= 0)
+  {
+    return static_cast<unsigned>(t_node.m_fixed);
+  }
+
+  // Threads rarely migrate between nodes, so only ask the kernel now and then
+  if (0 == t_node.m_countdown)
+  {
+    unsigned cpu = 0;
+    unsigned node = 0;
+#ifdef SYS_getcpu
+    if (0 == syscall(SYS_getcpu, &cpu, &node, nullptr))
+    {
+      t_node.m_node = node;
+    }
+#endif
+    t_node.m_countdown = NODE_REFRESH;
+  }
+  --t_node.m_countdown;
+  return t_node.m_node;
+}
+
+void NumaMemoryPool::setThreadNode(int node) { t_node.m_fixed = node; }
+
+unsigned NumaMemoryPool::detectNodes()
+{
+  // The online node list reads like "0" or "0-1,3", so the highest node is
+  // the last number in it
+  unsigned nodes = 1;
+  FILE *f = fopen("/sys/devices/system/node/online", "r");
+  if (f)
+  {
+    char list[256];
+    if (fgets(list, sizeof(list), f))
+    {
+      unsigned last = 0;
+      for (char *c = list; *c; ++c)
+      {
+        if ((*c >= '0') && (*c <= '9'))
+        {
+          last = last * 10 + (*c - '0');
+        }
+        else if ((*c == ',') || (*c == '-'))
+        {
+          last = 0;
+        }
+      }
+      nodes = last + 1;
+    }
+    fclose(f);
+  }
+  return (nodes > NODE_MAX) ? NODE_MAX : nodes;
+}
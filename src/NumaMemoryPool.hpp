@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "MemoryPool.hpp"
+
+/**
+ * @class NumaMemoryPool NumaMemoryPool
+ *
+ * Define a set of memory pools, one per NUMA node, each with its heap and
+ * allocation state placed on its node. Allocations are served from the pool of
+ * the calling thread's node, falling back to the other nodes when it is
+ * exhausted, and releases go back to the pool of the node the block lives on.
+ *
+ * The calling thread's node is read with the getcpu system call and cached for
+ * NODE_REFRESH allocations, or can be fixed with setThreadNode() for threads
+ * pinned by the application. Asking for more nodes than the machine has gives
+ * extra unplaced pools, so the node routing can be exercised on a single node
+ * machine.
+ *
+ * Each node's pool maps its own heap, so NUMA pools are not available in
+ * builds defining POOL_STATIC_HEAP.
+ */
+class NumaMemoryPool
+{
+public:
+  /**
+   * @brief Construct one pool per node
+   *
+   * @param config Configuration of each node's pool (the heap size is per
+   * node); check isInitialized() for success
+   * @param nNodes Number of nodes, or 0 to use the nodes of the machine
+   */
+  explicit NumaMemoryPool(const PoolConfig &config, unsigned nNodes = 0);
+  ~NumaMemoryPool();
+
+  NumaMemoryPool() = delete;
+  NumaMemoryPool &operator=(const NumaMemoryPool &other) = delete;
+  NumaMemoryPool(const NumaMemoryPool &other) = delete;
+
+  /**
+   * @brief Return whether every node's pool is initialized
+   *
+   * @return true Pools are initialized and ready for use
+   * @return false A pool could not be initialized
+   */
+  bool isInitialized() { return m_initialized; }
+
+  /**
+   * @brief Allocate blocks of at least n bytes, preferring the calling
+   * thread's node
+   *
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to the allocated memory block, or null on failure
+   */
+  void *allocate(size_t n);
+
+  /**
+   * @brief Release memory allocation pointed to by pointer p back to the pool
+   * of its node
+   *
+   * @param[in] p Pointer to memory block to release
+   */
+  void release(void *p);
+
+  /**
+   * @brief Release memory allocation pointed to by pointer p back to the pool
+   * of its node, given the size it was allocated with
+   *
+   * @param[in] p Pointer to memory block to release
+   * @param n Number of bytes requested when the block was allocated
+   */
+  void release(void *p, size_t n);
+
+  /**
+   * @brief Get the number of node pools
+   *
+   * @return unsigned Number of nodes
+   */
+  unsigned getNodeCount() { return m_nNodes; }
+
+  /**
+   * @brief Get the pool of a node
+   *
+   * @param node Node number, less than getNodeCount()
+   * @return MemoryPool& Pool whose heap is placed on the node
+   */
+  MemoryPool &getNodePool(unsigned node) { return *m_pool[node]; }
+
+  /**
+   * @brief Find the node a block lives on
+   *
+   * @param p Address of the block
+   * @return int Node number, or -1 if the block belongs to no node's pool
+   */
+  int nodeOf(const void *p);
+
+  /**
+   * @brief Get the node the calling thread runs on (or was fixed to)
+   *
+   * @return unsigned Node number
+   */
+  static unsigned threadNode();
+
+  /**
+   * @brief Fix the node the calling thread allocates from
+   *
+   * @param node Node number, or -1 to go back to asking the kernel
+   */
+  static void setThreadNode(int node);
+
+  /**
+   * @brief Count the NUMA nodes of the machine
+   *
+   * @return unsigned Number of nodes (1 when the machine reports none)
+   */
+  static unsigned detectNodes();
+
+  /** @brief Maximum number of node pools */
+  static constexpr unsigned NODE_MAX = 8;
+  /** @brief Allocations between reads of the calling thread's node */
+  static constexpr unsigned NODE_REFRESH = 1024;
+
+private:
+  /** @brief Pool of each node */
+  MemoryPool *m_pool[NODE_MAX]{};
+  /** @brief Number of node pools */
+  unsigned m_nNodes{0};
+  /** @brief Flag denoting whether every node's pool has been initialized */
+  bool m_initialized{false};
+};
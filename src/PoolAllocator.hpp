@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "MemoryPool.hpp"
+
+/**
+ * @class PoolAllocator PoolAllocator
+ *
+ * Define an allocator meeting the Allocator named requirements that serves
+ * allocations from a MemoryPool, so standard containers (and their nodes)
+ * draw their memory from the pool.
+ *
+ * Requests the pool cannot serve, because they are larger than the biggest
+ * block size, need an alignment no block size has, or find their size classes
+ * exhausted, fall through to the global operator new. The pool
+ * is not owned and must outlive every container using it.
+ *
+ * @tparam T Type of the objects allocated
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+  using value_type = T;
+
+  /**
+   * @brief Construct an allocator over a pool
+   *
+   * @param pool Pool to allocate from
+   */
+  explicit PoolAllocator(MemoryPool &pool) noexcept : m_pool(&pool) {}
+
+  /**
+   * @brief Construct an allocator for T sharing the pool of an allocator for
+   * another type (used by containers to allocate their nodes)
+   */
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U> &other) noexcept
+      : m_pool(other.getPool())
+  {
+  }
+
+  /**
+   * @brief Allocate storage for n objects of type T
+   *
+   * @param n Number of objects
+   * @return T* Pointer to uninitialized storage
+   * @throw std::bad_array_new_length n * sizeof(T) does not fit a size_t
+   */
+  T *allocate(size_t n)
+  {
+    if (n > SIZE_MAX / sizeof(T))
+    {
+      throw std::bad_array_new_length();
+    }
+    size_t bytes = n * sizeof(T);
+    void *p = m_pool->allocate(bytes, alignof(T));
+    if (p)
+    {
+      return static_cast<T *>(p);
+    }
+    if (alignof(T) <= MemoryPool::ALIGN_MAX)
+    {
+      return static_cast<T *>(::operator new(bytes));
+    }
+    return static_cast<T *>(
+        ::operator new(bytes, std::align_val_t(alignof(T))));
+  }
+
+  /**
+   * @brief Release storage obtained from allocate()
+   *
+   * @param p Pointer returned by allocate()
+   * @param n Number of objects passed to allocate()
+   */
+  void deallocate(T *p, size_t n) noexcept
+  {
+    if (m_pool->owns(p) || m_pool->isOverflow(p))
+    {
+      m_pool->release(p, n * sizeof(T));
+    }
+    else if (alignof(T) <= MemoryPool::ALIGN_MAX)
+    {
+      ::operator delete(p);
+    }
+    else
+    {
+      ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+  }
+
+  /**
+   * @brief Get the pool allocations are served from
+   *
+   * @return MemoryPool* Pool backing the allocator
+   */
+  MemoryPool *getPool() const noexcept { return m_pool; }
+
+private:
+  /** @brief Pool allocations are served from */
+  MemoryPool *m_pool;
+};
+
+/** @brief Allocators are interchangeable when they share a pool */
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept
+{
+  return a.getPool() == b.getPool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &a, const PoolAllocator<U> &b) noexcept
+{
+  return !(a == b);
+}
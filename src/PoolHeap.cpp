@@ -0,0 +1,144 @@
+#include "PoolHeap.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// NUMA placement goes straight to the system call, so only the kernel header
+// is needed rather than libnuma
+#if defined(__linux__) && __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#define POOL_HAVE_MBIND
+#endif
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+PoolHeap::~PoolHeap() { unmap(); }
+
+bool PoolHeap::map(size_t bytes, unsigned flags)
+{
+  unmap();
+  if (0 == bytes)
+  {
+    return false;
+  }
+
+  const int prot = PROT_READ | PROT_WRITE;
+  const int anon = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *p = MAP_FAILED;
+
+  // 1. Explicit huge pages, which fail outright if the hugetlbfs pool is empty
+  if (flags & HEAP_HUGETLB)
+  {
+#ifdef MAP_HUGETLB
+    size_t length = roundUp(bytes, HUGE_PAGE_SIZE);
+    p = mmap(nullptr, length, prot, anon | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED != p)
+    {
+      m_mapped = length;
+      m_hugeTlb = true;
+    }
+#endif
+#ifdef DEBUG
+    if (MAP_FAILED == p)
+    {
+      std::cerr << " !! Unable to map " << bytes
+                << " bytes of explicit huge pages!" << std::endl;
+    }
+#endif
+  }
+
+  // 2. Transparent huge pages, which need a huge page aligned region. Map an
+  // extra huge page worth of address space and trim both ends to align it.
+  if ((MAP_FAILED == p) && (flags & HEAP_THP))
+  {
+    size_t length = roundUp(bytes, HUGE_PAGE_SIZE);
+    void *raw = mmap(nullptr, length + HUGE_PAGE_SIZE, prot, anon, -1, 0);
+    if (MAP_FAILED != raw)
+    {
+      uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+      uintptr_t aligned = roundUp(start, HUGE_PAGE_SIZE);
+      if (aligned > start)
+      {
+        munmap(raw, aligned - start);
+      }
+      size_t tail = (start + length + HUGE_PAGE_SIZE) - (aligned + length);
+      if (tail)
+      {
+        munmap(reinterpret_cast<void *>(aligned + length), tail);
+      }
+      p = reinterpret_cast<void *>(aligned);
+      m_mapped = length;
+#ifdef MADV_HUGEPAGE
+      madvise(p, length, MADV_HUGEPAGE);
+#endif
+    }
+  }
+
+  // 3. Regular pages
+  if (MAP_FAILED == p)
+  {
+    size_t length = roundUp(bytes, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    p = mmap(nullptr, length, prot, anon, -1, 0);
+    if (MAP_FAILED == p)
+    {
+#ifdef DEBUG
+      std::cerr << " !! Unable to map " << bytes << " bytes!" << std::endl;
+#endif
+      return false;
+    }
+    m_mapped = length;
+  }
+
+  m_data = static_cast<uint8_t *>(p);
+  m_size = bytes;
+
+#ifdef DEBUG
+  std::cout << " ** Mapped " << m_mapped << " bytes @ "
+            << static_cast<void *>(m_data) << (m_hugeTlb ? " (hugetlb)" : "")
+            << std::endl;
+#endif
+
+  return true;
+}
+
+bool PoolHeap::bindNode(unsigned node)
+{
+#ifdef POOL_HAVE_MBIND
+  unsigned long mask = 0;
+  if (!m_data || (node >= sizeof(mask) * 8 - 1))
+  {
+    return false;
+  }
+
+  // The kernel only reads maxnode - 1 bits of the mask, so the top bit of the
+  // word can never name a node
+  mask = 1UL << node;
+  if (0 == syscall(SYS_mbind, m_data, m_mapped, MPOL_PREFERRED, &mask,
+               sizeof(mask) * 8, 0))
+  {
+    return true;
+  }
+#ifdef DEBUG
+  std::cerr << " !! Unable to place " << m_mapped << " bytes on node " << node
+            << "!" << std::endl;
+#endif
+#else
+  (void)node;
+#endif
+  return false;
+}
+
+void PoolHeap::unmap()
+{
+  if (m_data)
+  {
+    munmap(m_data, m_mapped);
+  }
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = 0;
+  m_hugeTlb = false;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class PoolHeap PoolHeap
+ *
+ * Define a region of anonymous memory mapped at runtime to back a memory pool.
+ * The region can optionally be backed by explicit huge pages (MAP_HUGETLB) or
+ * aligned and advised for transparent huge pages, both of which cut TLB misses
+ * on large pools. When explicit huge pages are unavailable the mapping falls
+ * back to regular pages.
+ *
+ * The region can also be placed on a NUMA node (see bindNode()).
+ *
+ * Freshly mapped memory is always zero filled. The region is unmapped when the
+ * PoolHeap is destroyed.
+ */
+class PoolHeap
+{
+public:
+  /** @brief Options controlling how the region is mapped */
+  enum Flags : unsigned
+  {
+    /** @brief Regular pages */
+    HEAP_DEFAULT = 0x0,
+    /** @brief Explicit huge pages from the hugetlbfs pool */
+    HEAP_HUGETLB = 0x1,
+    /** @brief Huge page aligned and advised for transparent huge pages */
+    HEAP_THP = 0x2,
+  };
+
+  PoolHeap() = default;
+  ~PoolHeap();
+  PoolHeap &operator=(const PoolHeap &other) = delete;
+  PoolHeap(const PoolHeap &other) = delete;
+
+  /**
+   * @brief Map a new region, releasing any region already held
+   *
+   * @param bytes Minimum number of usable bytes in the region
+   * @param flags Combination of Flags values
+   * @return true Region mapped successfully
+   * @return false Unable to map the region
+   */
+  bool map(size_t bytes, unsigned flags = HEAP_DEFAULT);
+
+  /**
+   * @brief Ask the kernel to place the region's pages on a NUMA node
+   *
+   * Must be called before the pages are first touched. Uses the mbind system
+   * call directly (no libnuma) with a preferred rather than strict policy, so
+   * a full node spills over instead of failing. Does nothing on platforms
+   * without mbind.
+   *
+   * @param node NUMA node number
+   * @return true Placement policy applied
+   * @return false No region, mbind unavailable, or the node does not exist
+   */
+  bool bindNode(unsigned node);
+
+  /**
+   * @brief Release the region back to the operating system
+   */
+  void unmap();
+
+  /**
+   * @brief Get the start address of the region
+   *
+   * @return uint8_t* First byte of the region, or nullptr if none is mapped
+   */
+  uint8_t *data() { return m_data; }
+
+  /**
+   * @brief Get the number of usable bytes in the region
+   *
+   * @return size_t Number of bytes requested when the region was mapped
+   */
+  size_t size() { return m_size; }
+
+  /**
+   * @brief Return whether the region is backed by explicit huge pages
+   *
+   * @return true Region was mapped with MAP_HUGETLB
+   * @return false Region uses regular (or transparent huge) pages
+   */
+  bool isHugeTlb() { return m_hugeTlb; }
+
+  /** @brief Size of a huge page on the supported platforms */
+  static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+private:
+  /**
+   * @brief Round a length up to a multiple of a power of 2 alignment
+   */
+  static size_t roundUp(size_t n, size_t align)
+  {
+    return (n + align - 1) & ~(align - 1);
+  }
+
+  /** @brief Start of the region */
+  uint8_t *m_data{nullptr};
+  /** @brief Number of usable bytes */
+  size_t m_size{0};
+  /** @brief Number of bytes actually mapped (page or huge page rounded) */
+  size_t m_mapped{0};
+  /** @brief Flag denoting whether the region uses explicit huge pages */
+  bool m_hugeTlb{false};
+};
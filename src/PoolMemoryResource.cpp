@@ -0,0 +1,38 @@
+#include "PoolMemoryResource.hpp"
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+void *PoolMemoryResource::do_allocate(size_t bytes, size_t alignment)
+{
+  void *p = m_pool->allocate(bytes, alignment);
+  if (p)
+  {
+    return p;
+  }
+
+#ifdef DEBUG
+  std::cout << " ** Passing " << bytes << " bytes aligned to " << alignment
+            << " upstream" << std::endl;
+#endif
+  return m_upstream->allocate(bytes, alignment);
+}
+
+void PoolMemoryResource::do_deallocate(void *p, size_t bytes, size_t alignment)
+{
+  if (m_pool->owns(p) || m_pool->isOverflow(p))
+  {
+    m_pool->release(p, (bytes > alignment) ? bytes : alignment);
+  }
+  else
+  {
+    m_upstream->deallocate(p, bytes, alignment);
+  }
+}
+
+bool PoolMemoryResource::do_is_equal(
+    const std::pmr::memory_resource &other) const noexcept
+{
+  return this == &other;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include "MemoryPool.hpp"
+
+/**
+ * @class PoolMemoryResource PoolMemoryResource
+ *
+ * Define a polymorphic memory resource serving allocations from a MemoryPool,
+ * so std::pmr containers (and their nodes) draw their memory from the pool.
+ *
+ * Requests the pool cannot serve, because they are larger than the biggest
+ * block size, need an alignment no block size has, or find their size classes
+ * exhausted, fall through to an upstream resource. The pool is
+ * not owned and must outlive the resource.
+ */
+class PoolMemoryResource : public std::pmr::memory_resource
+{
+public:
+  /**
+   * @brief Construct a resource over a pool
+   *
+   * @param pool Pool to allocate from
+   * @param upstream Resource serving requests the pool cannot
+   */
+  explicit PoolMemoryResource(MemoryPool &pool,
+      std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+      : m_pool(&pool), m_upstream(upstream)
+  {
+  }
+
+  PoolMemoryResource &operator=(const PoolMemoryResource &other) = delete;
+  PoolMemoryResource(const PoolMemoryResource &other) = delete;
+
+  /**
+   * @brief Get the pool allocations are served from
+   *
+   * @return MemoryPool* Pool backing the resource
+   */
+  MemoryPool *getPool() const { return m_pool; }
+
+  /**
+   * @brief Get the resource serving requests the pool cannot
+   *
+   * @return std::pmr::memory_resource* Upstream resource
+   */
+  std::pmr::memory_resource *getUpstream() const { return m_upstream; }
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource &other) const noexcept override;
+
+private:
+  /** @brief Pool allocations are served from */
+  MemoryPool *m_pool;
+  /** @brief Resource serving requests the pool cannot */
+  std::pmr::memory_resource *m_upstream;
+};
@@ -0,0 +1,210 @@
+#include "PoolSampler.hpp"
+
+#include <execinfo.h>
+
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+/**
+ * @struct SampleClock
+ *
+ * Define the per-thread countdown to the next sampled allocation
+ */
+struct SampleClock
+{
+  /** @brief Rate the countdown was drawn for */
+  size_t m_rate{0};
+  /** @brief Bytes left to allocate before the next sample */
+  size_t m_left{0};
+  /** @brief State of the random number generator (xorshift64*) */
+  uint64_t m_seed{0};
+};
+
+thread_local SampleClock t_clock;
+
+/**
+ * @brief Draw the distance in bytes to the next sample
+ */
+size_t nextSample(SampleClock &clock, size_t rate)
+{
+  if (!clock.m_seed)
+  {
+    clock.m_seed = (reinterpret_cast<uintptr_t>(&clock) | 1) *
+                   UINT64_C(0x9E3779B97F4A7C15);
+  }
+  clock.m_seed ^= clock.m_seed >> 12;
+  clock.m_seed ^= clock.m_seed << 25;
+  clock.m_seed ^= clock.m_seed >> 27;
+
+  // Uniform in (0, 1], turned into an exponential variable of mean rate
+  double u = ((clock.m_seed * UINT64_C(0x2545F4914F6CDD1D)) >> 11) + 1.0;
+  u *= 1.0 / 9007199254740992.0;
+  return static_cast<size_t>(-std::log(u) * static_cast<double>(rate)) + 1;
+}
+
+/**
+ * @brief Write the return addresses of a sample
+ */
+void writeFrames(std::ostream &out, void *const *frames, size_t depth)
+{
+  out << " @" << std::hex;
+  for (size_t k = 0; k < depth; ++k)
+  {
+    out << " 0x" << reinterpret_cast<uintptr_t>(frames[k]);
+  }
+  out << std::dec << "\n";
+}
+} // namespace
+
+PoolSampler::PoolSampler()
+{
+  for (auto &slot : m_slot)
+  {
+    slot.store(nullptr, std::memory_order_relaxed);
+  }
+
+  // The unwinder loads itself (and allocates) on its first use, which must
+  // not happen in the middle of a sampled allocation
+  void *frame = nullptr;
+  backtrace(&frame, 1);
+}
+
+bool PoolSampler::tick(size_t n, size_t rate)
+{
+  SampleClock &clock = t_clock;
+  if ((clock.m_rate == rate) && (clock.m_left > n))
+  {
+    clock.m_left -= n;
+    return false;
+  }
+
+  // A countdown drawn for an older rate is restarted without sampling
+  bool sampled = (clock.m_rate == rate);
+  clock.m_rate = rate;
+  clock.m_left = nextSample(clock, rate);
+  return sampled;
+}
+
+size_t PoolSampler::slotOf(const void *p)
+{
+  return static_cast<size_t>((reinterpret_cast<uintptr_t>(p) >> 4) *
+                                 UINT64_C(0x9E3779B97F4A7C15) >>
+                             (64 - SLOT_BITS));
+}
+
+void PoolSampler::record(const void *p, size_t n, size_t blockSize)
+{
+  // Capture the stack before taking the lock
+  Sample sample;
+  sample.m_size = n;
+  sample.m_blockSize = blockSize;
+  sample.m_depth = backtrace(sample.m_frames, DEPTH_MAX);
+
+  std::lock_guard<std::mutex> lk(m_lock);
+  size_t slot = slotOf(p);
+  for (size_t k = 0; k < PROBE_MAX; ++k, slot = (slot + 1) % SLOTS)
+  {
+    if (!m_slot[slot].load(std::memory_order_relaxed))
+    {
+      m_sample[slot] = sample;
+      m_slot[slot].store(p, std::memory_order_release);
+      ++m_live;
+      return;
+    }
+  }
+  ++m_dropped;
+}
+
+void PoolSampler::remove(const void *p)
+{
+  // Only the allocating thread records a block, before handing it out, so a
+  // release sees its sample without the lock
+  size_t slot = slotOf(p);
+  for (size_t k = 0; p && (k < PROBE_MAX); ++k, slot = (slot + 1) % SLOTS)
+  {
+    if (m_slot[slot].load(std::memory_order_acquire) == p)
+    {
+      // Releasing the same block twice races for the slot
+      std::lock_guard<std::mutex> lk(m_lock);
+      if (m_slot[slot].load(std::memory_order_relaxed) == p)
+      {
+        m_slot[slot].store(nullptr, std::memory_order_relaxed);
+        --m_live;
+      }
+      return;
+    }
+  }
+}
+
+size_t PoolSampler::dump(std::ostream &out, unsigned format, size_t rate)
+{
+  // Copy the samples out first, as writing them may allocate from the pool
+  std::vector<Sample> live;
+  size_t count = 0;
+  size_t dropped = 0;
+  {
+    std::lock_guard<std::mutex> lk(m_lock);
+    count = m_live;
+  }
+  live.reserve(count + 64);
+  {
+    std::lock_guard<std::mutex> lk(m_lock);
+    for (size_t slot = 0; (slot < SLOTS) && (live.size() < live.capacity());
+         ++slot)
+    {
+      if (m_slot[slot].load(std::memory_order_relaxed))
+      {
+        live.push_back(m_sample[slot]);
+      }
+    }
+    dropped = m_dropped;
+  }
+
+  if (FORMAT_PPROF == format)
+  {
+    uint64_t bytes = 0;
+    for (auto &s : live)
+    {
+      bytes += s.m_blockSize ? s.m_blockSize : s.m_size;
+    }
+    out << "heap profile: " << live.size() << ": " << bytes << " ["
+        << live.size() << ": " << bytes << "] @ heap_v2/" << rate << "\n";
+    for (auto &s : live)
+    {
+      size_t size = s.m_blockSize ? s.m_blockSize : s.m_size;
+      out << "1: " << size << " [1: " << size << "]";
+      writeFrames(out, s.m_frames, s.m_depth);
+    }
+
+    // Let pprof map the addresses back to the loaded objects
+    out << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    if (maps)
+    {
+      out << maps.rdbuf();
+    }
+  }
+  else
+  {
+    out << "pool samples: " << live.size() << " live, 1 in " << rate
+        << " bytes, " << dropped << " dropped\n";
+    for (auto &s : live)
+    {
+      out << s.m_size << " bytes in ";
+      if (s.m_blockSize)
+      {
+        out << s.m_blockSize << " byte blocks";
+      }
+      else
+      {
+        out << "overflow";
+      }
+      writeFrames(out, s.m_frames, s.m_depth);
+    }
+  }
+  out.flush();
+  return live.size();
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+/**
+ * @class PoolSampler PoolSampler
+ *
+ * Define a sampling profiler of the allocations made from a pool. Each thread
+ * counts down the bytes it allocates and samples the allocation that crosses
+ * zero, drawing the next distance from an exponential distribution whose mean
+ * is the sampling rate, so that every byte is equally likely to be sampled. A
+ * sample records the requested size, the block size serving it and the call
+ * stack, and is dropped again when its block is released.
+ *
+ * Live samples sit in a fixed table indexed by block address. Recording and
+ * dumping take a lock, while a release only probes a few slots without one,
+ * so releases stay cheap however many samples are live. A sample that finds
+ * no free slot near its address is counted as dropped.
+ */
+class PoolSampler
+{
+public:
+  /** @brief Formats of a dump of the live samples */
+  enum Format : unsigned
+  {
+    /** @brief One line per sample, for people */
+    FORMAT_TEXT = 0,
+    /** @brief Legacy heap profile, as read by pprof */
+    FORMAT_PPROF = 1,
+  };
+
+  /** @brief log2 of the number of samples that can be live at once */
+  static constexpr size_t SLOT_BITS = 12;
+  /** @brief Number of samples that can be live at once */
+  static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+  /** @brief Number of slots searched for a block address */
+  static constexpr size_t PROBE_MAX = 8;
+  /** @brief Deepest call stack recorded */
+  static constexpr size_t DEPTH_MAX = 32;
+
+  PoolSampler();
+  ~PoolSampler() = default;
+  PoolSampler &operator=(const PoolSampler &other) = delete;
+  PoolSampler(const PoolSampler &other) = delete;
+
+  /**
+   * @brief Count n bytes allocated by the calling thread against the
+   * sampling rate
+   *
+   * @param n Number of bytes allocated
+   * @param rate Mean number of bytes between samples
+   * @return true The allocation is to be sampled
+   */
+  static bool tick(size_t n, size_t rate);
+
+  /**
+   * @brief Record a sampled allocation together with the calling stack
+   *
+   * @param p Address of the allocated block
+   * @param n Number of bytes requested
+   * @param blockSize Size of the block serving the request (0 if it came from
+   * the overflow)
+   */
+  void record(const void *p, size_t n, size_t blockSize);
+
+  /**
+   * @brief Drop the sample of a block being released, if it has one
+   *
+   * @param p Address of the block
+   */
+  void remove(const void *p);
+
+  /**
+   * @brief Write the live samples
+   *
+   * @param out Stream receiving the samples
+   * @param format Format of the dump (see Format)
+   * @param rate Sampling rate, scaling the samples back up in a profile
+   * @return size_t Number of live samples written
+   */
+  size_t dump(std::ostream &out, unsigned format, size_t rate);
+
+private:
+  /**
+   * @struct Sample Sample
+   *
+   * Define the record of a sampled allocation
+   */
+  struct Sample
+  {
+    /** @brief Number of bytes requested */
+    size_t m_size{0};
+    /** @brief Size of the block serving the request (0 for overflow) */
+    size_t m_blockSize{0};
+    /** @brief Number of return addresses captured */
+    size_t m_depth{0};
+    /** @brief Return addresses of the allocating call stack */
+    void *m_frames[DEPTH_MAX];
+  };
+
+  /** @brief Slot a block address hashes to */
+  static size_t slotOf(const void *p);
+
+  /** @brief Block address held by each slot (nullptr when free) */
+  std::atomic<const void *> m_slot[SLOTS];
+  /** @brief Sample held by each slot */
+  Sample m_sample[SLOTS];
+  /** @brief Serializes changes to the table and dumps */
+  std::mutex m_lock;
+  /** @brief Number of samples in the table */
+  size_t m_live{0};
+  /** @brief Number of samples lost to a full neighbourhood */
+  size_t m_dropped{0};
+};
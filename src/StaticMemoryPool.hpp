@@ -0,0 +1,280 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "BlockAllocator.hpp"
+#include "MemoryPool.hpp"
+
+/**
+ * @struct StaticPoolLayout StaticPoolLayout
+ *
+ * Define the compile-time computations behind BasicStaticMemoryPool: sorting
+ * and checking the block sizes and building its lookup tables.
+ */
+struct StaticPoolLayout
+{
+  /** @brief Number of bits in a request size */
+  static constexpr size_t SIZE_BITS = sizeof(size_t) * 8;
+  /** @brief Number of entries in the size class lookup table */
+  static constexpr size_t CLASS_LOOKUP_SIZE = SIZE_BITS + 1;
+
+  /**
+   * @brief Map a request size to its power of 2 size class
+   */
+  static constexpr size_t sizeClass(size_t n)
+  {
+    return (n <= 1) ? 0 : SIZE_BITS - __builtin_clzll(n - 1);
+  }
+
+  /**
+   * @brief Sort block sizes in ascending order
+   */
+  template <size_t N>
+  static constexpr std::array<size_t, N> sorted(std::array<size_t, N> a)
+  {
+    for (size_t i = 1; i < N; ++i)
+    {
+      for (size_t j = i; (j > 0) && (a[j - 1] > a[j]); --j)
+      {
+        size_t temp = a[j];
+        a[j] = a[j - 1];
+        a[j - 1] = temp;
+      }
+    }
+    return a;
+  }
+
+  /**
+   * @brief Determine if sorted block sizes are all different
+   */
+  template <size_t N>
+  static constexpr bool distinct(const std::array<size_t, N> &a)
+  {
+    for (size_t i = 1; i < N; ++i)
+    {
+      if (a[i - 1] == a[i])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Index of the first sorted block size able to hold n bytes (N if
+   * none)
+   */
+  template <size_t N>
+  static constexpr size_t classIndex(const std::array<size_t, N> &a, size_t n)
+  {
+    size_t i = 0;
+    while ((i < N) && (a[i] < n))
+    {
+      ++i;
+    }
+    return i;
+  }
+
+  /**
+   * @brief Build the power of 2 size class to allocator index table
+   */
+  template <size_t N>
+  static constexpr std::array<uint8_t, CLASS_LOOKUP_SIZE> classTable(
+      const std::array<size_t, N> &a)
+  {
+    std::array<uint8_t, CLASS_LOOKUP_SIZE> table{};
+    for (size_t k = 0; k < CLASS_LOOKUP_SIZE; ++k)
+    {
+      table[k] = static_cast<uint8_t>(
+          (k < SIZE_BITS) ? classIndex(a, size_t(1) << k) : N);
+    }
+    return table;
+  }
+
+  /**
+   * @brief Number of state bitmap words for every allocator
+   */
+  template <size_t N>
+  static constexpr size_t stateWords(const std::array<size_t, N> &a,
+      size_t sliceBytes)
+  {
+    size_t words = 0;
+    for (size_t i = 0; i < N; ++i)
+    {
+      words += BlockAllocator::stateWords(sliceBytes / a[i], a[i]);
+    }
+    return words;
+  }
+};
+
+/**
+ * @class BasicStaticMemoryPool BasicStaticMemoryPool
+ *
+ * Define a memory pool whose block sizes are fixed at compile time. The rules
+ * MemoryPool checks at runtime (power of 2 sizes, number of sizes, minimum
+ * size, sizes fitting their slice of the heap) are enforced with static_assert,
+ * and the sorted size table and slice layout are computed by the compiler.
+ *
+ * When the request size is a compile-time constant, allocate<N>() resolves the
+ * size class at compile time, so the allocator is picked with no dispatch at
+ * all; only exhausting a class falls through to the next larger one. Hot paths
+ * allocating fixed-size structures should use allocate<sizeof(T)>().
+ *
+ * The heap and allocation state bitmaps live inside the object, so a pool is
+ * typically declared with static storage duration. Blocks are served directly
+ * from the lock-free allocators, without thread caches.
+ *
+ * @tparam HeapBytes Number of bytes in the pool heap
+ * @tparam Sizes Block sizes, in any order
+ */
+template <size_t HeapBytes, size_t... Sizes>
+class BasicStaticMemoryPool
+{
+public:
+  /** @brief Number of size classes */
+  static constexpr size_t N_SIZES = sizeof...(Sizes);
+  static_assert(N_SIZES > 0, "At least one block size is required");
+  static_assert(N_SIZES <= MemoryPool::BLKCNT_MAX,
+      "Number of block sizes exceeds the maximum");
+  static_assert(((Sizes && !(Sizes & (Sizes - 1))) && ...),
+      "All block sizes must be a power of 2");
+  static_assert(((Sizes >= sizeof(MemoryBlock)) && ...),
+      "Block sizes must be at least the size of a MemoryBlock");
+
+  /** @brief Block sizes in ascending order */
+  static constexpr std::array<size_t, N_SIZES> BLOCK_SIZES =
+      StaticPoolLayout::sorted(std::array<size_t, N_SIZES>{Sizes...});
+  static_assert(StaticPoolLayout::distinct(BLOCK_SIZES),
+      "Block sizes must be distinct");
+
+  /** @brief Largest block size */
+  static constexpr size_t MAX_BLOCK = BLOCK_SIZES[N_SIZES - 1];
+  /** @brief Bytes in each allocator slice, a whole number of largest blocks */
+  static constexpr size_t SLICE_BYTES =
+      (HeapBytes / N_SIZES) & ~(MAX_BLOCK - 1);
+  static_assert(SLICE_BYTES >= MAX_BLOCK,
+      "Heap is too small to hold a block of every size");
+
+  BasicStaticMemoryPool()
+  {
+    std::atomic<uint64_t> *state = m_state;
+    for (size_t i = 0; i < N_SIZES; ++i)
+    {
+      m_allocator[i] = BlockAllocator(BLOCK_SIZES[i], SLICE_BYTES,
+          reinterpret_cast<MemoryBlock *>(&m_heap[i * SLICE_BYTES]), state);
+      state += BlockAllocator::stateWords(
+          SLICE_BYTES / BLOCK_SIZES[i], BLOCK_SIZES[i]);
+    }
+  }
+
+  // Allocators point into the object, so it can be neither copied nor moved
+  BasicStaticMemoryPool &operator=(const BasicStaticMemoryPool &other) = delete;
+  BasicStaticMemoryPool(const BasicStaticMemoryPool &other) = delete;
+
+  /**
+   * @brief Allocate a block of at least N bytes, with the size class resolved
+   * at compile time
+   *
+   * @tparam N Number of bytes to allocate
+   * @return void* Pointer to the allocated memory block, or null on failure
+   */
+  template <size_t N>
+  void *allocate()
+  {
+    constexpr size_t i = StaticPoolLayout::classIndex(BLOCK_SIZES, N);
+    static_assert(i < N_SIZES, "No block size can hold N bytes");
+    return allocateFrom<i>();
+  }
+
+  /**
+   * @brief Allocate a block of at least n bytes
+   *
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to the allocated memory block, or null on failure
+   */
+  void *allocate(size_t n)
+  {
+    MemoryBlock *block = nullptr;
+    for (size_t i = CLASS_INDEX[StaticPoolLayout::sizeClass(n)];
+         !block && (i < N_SIZES); ++i)
+    {
+      block = m_allocator[i].allocateBlock();
+    }
+    return block;
+  }
+
+  /**
+   * @brief Release a block allocated with allocate<N>(), going straight to the
+   * allocator of its size class
+   *
+   * @tparam N Number of bytes requested when the block was allocated
+   * @param p Pointer to memory block to release
+   */
+  template <size_t N>
+  void release(void *p)
+  {
+    // A block that fell through to a larger class takes the general path
+    constexpr size_t i = StaticPoolLayout::classIndex(BLOCK_SIZES, N);
+    static_assert(i < N_SIZES, "No block size can hold N bytes");
+    if (!m_allocator[i].releaseBlock(p))
+    {
+      release(p);
+    }
+  }
+
+  /**
+   * @brief Release memory allocation pointed to by pointer p back to pool
+   *
+   * @param p Pointer to memory block to release
+   */
+  void release(void *p)
+  {
+    size_t offset = reinterpret_cast<uintptr_t>(p) -
+                    reinterpret_cast<uintptr_t>(m_heap);
+    if (offset < sizeof(m_heap))
+    {
+      m_allocator[offset / SLICE_BYTES].releaseBlock(p);
+    }
+  }
+
+private:
+  /**
+   * @brief Allocate from class I, falling through to larger classes when empty
+   */
+  template <size_t I>
+  void *allocateFrom()
+  {
+    MemoryBlock *block = m_allocator[I].allocateBlock();
+    if constexpr (I + 1 < N_SIZES)
+    {
+      if (!block)
+      {
+        return allocateFrom<I + 1>();
+      }
+    }
+    return block;
+  }
+
+  /** @brief Index of the first allocator able to serve each size class */
+  static constexpr auto CLASS_INDEX = StaticPoolLayout::classTable(BLOCK_SIZES);
+  /** @brief Alignment of the heap, keeping blocks naturally aligned */
+  static constexpr size_t HEAP_ALIGN = (MAX_BLOCK < 4096) ? MAX_BLOCK : 4096;
+
+  /** @brief Heap used as pool memory */
+  alignas(HEAP_ALIGN) uint8_t m_heap[SLICE_BYTES * N_SIZES];
+  /** @brief Allocation state bitmaps for the heap */
+  std::atomic<uint64_t>
+      m_state[StaticPoolLayout::stateWords(BLOCK_SIZES, SLICE_BYTES)]{};
+  /** @brief Array of allocators, one per block size */
+  BlockAllocator m_allocator[N_SIZES];
+};
+
+/**
+ * @brief Compile-time specialized pool with the default heap size
+ *
+ * @tparam Sizes Block sizes, in any order
+ */
+template <size_t... Sizes>
+using StaticMemoryPool = BasicStaticMemoryPool<65536, Sizes...>;
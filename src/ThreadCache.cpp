@@ -0,0 +1,265 @@
+#include "ThreadCache.hpp"
+
+#include <mutex>
+
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+// Registry of live pools, guarding thread cache flushes against concurrent pool
+// destruction
+static std::mutex s_registryLock;
+static PoolRegistration *s_registry = nullptr;
+static uint64_t s_nextPoolId = 1;
+// Tables in use, whose caches hold the block counters of live pools
+static ThreadCacheTable *s_tables = nullptr;
+
+void ThreadCache::bind(uint64_t poolId,
+    BlockAllocator *allocator,
+    size_t nAllocators)
+{
+  m_poolId = poolId;
+  m_allocator = allocator;
+  m_nAllocators = nAllocators;
+}
+
+MemoryBlock *ThreadCache::allocate(size_t i, size_t depth, bool &carved)
+{
+  Bin &bin = m_bin[i];
+
+  // Refill an empty bin with a batch from the shared free list
+  if (!bin.m_head)
+  {
+    bool fresh = false;
+    bin.m_head =
+        m_allocator[i].allocateChain(batchSize(depth), bin.m_count, fresh);
+    bin.m_carved = fresh ? bin.m_count : 0;
+#ifdef DEBUG
+    std::cout << " ** Cache refilled " << bin.m_count << " blocks of size "
+              << m_allocator[i].getBlockSize() << std::endl;
+#endif
+  }
+
+  // Pop the most recently cached block (can be nullptr); once every released
+  // block above them is gone, the carved ones come out
+  auto block = bin.m_head;
+  carved = false;
+  if (block)
+  {
+    carved = (bin.m_count == bin.m_carved);
+    bin.m_head = block->m_next;
+    --bin.m_count;
+    bin.m_carved -= carved ? 1 : 0;
+  }
+
+  return block;
+}
+
+void ThreadCache::release(size_t i, MemoryBlock *block, size_t depth)
+{
+  Bin &bin = m_bin[i];
+
+  // Push the block to the front of the bin
+  block->m_next = bin.m_head;
+  bin.m_head = block;
+  ++bin.m_count;
+
+  // Bin grew past its depth, so give a batch back to the shared free list
+  if (bin.m_count > depth)
+  {
+    size_t batch = batchSize(depth);
+    size_t keep = (depth > batch) ? depth - batch : 0;
+    drain(i, bin.m_count - keep);
+  }
+}
+
+void ThreadCache::flush()
+{
+  for (size_t i = 0; i < m_nAllocators; ++i)
+  {
+    drain(i, m_bin[i].m_count);
+  }
+}
+
+void ThreadCache::discard()
+{
+  for (auto &bin : m_bin)
+  {
+    bin.m_head = nullptr;
+    bin.m_count = 0;
+    bin.m_carved = 0;
+    bin.m_allocations.store(0, std::memory_order_relaxed);
+    bin.m_frees.store(0, std::memory_order_relaxed);
+  }
+  m_poolId = 0;
+  m_allocator = nullptr;
+  m_nAllocators = 0;
+}
+
+void ThreadCache::drain(size_t i, size_t n)
+{
+  Bin &bin = m_bin[i];
+  if ((0 == n) || !bin.m_head)
+  {
+    return;
+  }
+
+  // Find the end of the chain being flushed
+  auto head = bin.m_head;
+  auto tail = head;
+  size_t count = 1;
+  while ((count < n) && tail->m_next)
+  {
+    tail = tail->m_next;
+    ++count;
+  }
+
+  bin.m_head = tail->m_next;
+  bin.m_count -= count;
+  bin.m_carved = (bin.m_carved < bin.m_count) ? bin.m_carved : bin.m_count;
+  m_allocator[i].releaseChain(head, tail, count);
+
+#ifdef DEBUG
+  std::cout << " ** Cache flushed " << count << " blocks of size "
+            << m_allocator[i].getBlockSize() << std::endl;
+#endif
+}
+
+ThreadCacheTable::~ThreadCacheTable()
+{
+  std::lock_guard<std::mutex> lk(s_registryLock);
+  for (auto &slot : m_slot)
+  {
+    PoolRegistration *r = slot.isBound() ? findPool(slot.getPoolId()) : nullptr;
+    if (r)
+    {
+      retire(slot, *r);
+    }
+    slot.discard();
+  }
+
+  for (auto entry = &s_tables; m_listed && *entry; entry = &(*entry)->m_next)
+  {
+    if (*entry == this)
+    {
+      *entry = m_next;
+      break;
+    }
+  }
+}
+
+void ThreadCacheTable::registerPool(PoolRegistration &r)
+{
+  std::lock_guard<std::mutex> lk(s_registryLock);
+  r.m_id = s_nextPoolId++;
+  r.m_next = s_registry;
+  s_registry = &r;
+}
+
+void ThreadCacheTable::unregisterPool(PoolRegistration &r)
+{
+  std::lock_guard<std::mutex> lk(s_registryLock);
+  for (auto entry = &s_registry; *entry; entry = &(*entry)->m_next)
+  {
+    if (*entry == &r)
+    {
+      *entry = r.m_next;
+      break;
+    }
+  }
+  r.m_next = nullptr;
+}
+
+void ThreadCacheTable::countBlocks(const PoolRegistration &r,
+    uint64_t *allocations,
+    uint64_t *frees)
+{
+  std::lock_guard<std::mutex> lk(s_registryLock);
+  for (size_t i = 0; i < ThreadCache::BIN_MAX; ++i)
+  {
+    allocations[i] = r.m_allocations[i];
+    frees[i] = r.m_frees[i];
+  }
+
+  // Caches only change pool under the lock, so each is counted exactly once
+  for (auto table = s_tables; table; table = table->m_next)
+  {
+    for (auto &slot : table->m_slot)
+    {
+      if (slot.isBound() && (slot.getPoolId() == r.m_id))
+      {
+        for (size_t i = 0; i < ThreadCache::BIN_MAX; ++i)
+        {
+          allocations[i] += slot.getAllocations(i);
+          frees[i] += slot.getFrees(i);
+        }
+      }
+    }
+  }
+}
+
+ThreadCache &ThreadCacheTable::lookup(uint64_t poolId,
+    BlockAllocator *allocator,
+    size_t nAllocators)
+{
+  for (size_t i = 0; i < SLOT_MAX; ++i)
+  {
+    if (m_slot[i].getPoolId() == poolId)
+    {
+      m_last = i;
+      return m_slot[i];
+    }
+  }
+
+  // First use of the pool by this thread: take a free slot or one whose pool
+  // has been destroyed, otherwise evict the cache of another pool
+  std::lock_guard<std::mutex> lk(s_registryLock);
+  if (!m_listed)
+  {
+    m_next = s_tables;
+    s_tables = this;
+    m_listed = true;
+  }
+  size_t slot = SLOT_MAX;
+  for (size_t i = 0; i < SLOT_MAX; ++i)
+  {
+    if (!m_slot[i].isBound() || !findPool(m_slot[i].getPoolId()))
+    {
+      slot = i;
+      break;
+    }
+  }
+  if (SLOT_MAX == slot)
+  {
+    slot = m_victim;
+    m_victim = (m_victim + 1) % SLOT_MAX;
+    retire(m_slot[slot], *findPool(m_slot[slot].getPoolId()));
+  }
+
+  m_slot[slot].discard();
+  m_slot[slot].bind(poolId, allocator, nAllocators);
+  m_last = slot;
+  return m_slot[slot];
+}
+
+PoolRegistration *ThreadCacheTable::findPool(uint64_t poolId)
+{
+  for (auto entry = s_registry; entry; entry = entry->m_next)
+  {
+    if (entry->m_id == poolId)
+    {
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+void ThreadCacheTable::retire(ThreadCache &cache, PoolRegistration &r)
+{
+  cache.flush();
+  for (size_t i = 0; i < ThreadCache::BIN_MAX; ++i)
+  {
+    r.m_allocations[i] += cache.getAllocations(i);
+    r.m_frees[i] += cache.getFrees(i);
+  }
+}
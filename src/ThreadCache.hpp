@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include "BlockAllocator.hpp"
+
+/**
+ * @class ThreadCache ThreadCache
+ *
+ * Define a per-thread cache of free blocks sitting in front of the shared
+ * BlockAllocator free lists. Each size class (bin) is itself a small intrusive
+ * free list of MemoryBlock objects that only the owning thread touches, so the
+ * common allocate/release path takes no lock at all.
+ *
+ * Blocks move between a bin and its BlockAllocator in batches of half the
+ * configured cache depth: an empty bin is refilled with a chain detached with a
+ * single exchange, and a bin that grows past the depth flushes a chain back the
+ * same way. All cached blocks are returned to the allocators when the owning
+ * thread exits (see ThreadCacheTable).
+ */
+class ThreadCache
+{
+public:
+  ThreadCache() = default;
+  ~ThreadCache() = default;
+  ThreadCache &operator=(const ThreadCache &other) = delete;
+  ThreadCache(const ThreadCache &other) = delete;
+
+  /**
+   * @brief Attach the cache to the allocators of a pool
+   *
+   * @param poolId Unique identifier of the pool owning the allocators
+   * @param allocator Array of allocators, one per bin
+   * @param nAllocators Number of allocators in the array
+   */
+  void bind(uint64_t poolId, BlockAllocator *allocator, size_t nAllocators);
+
+  /**
+   * @brief Return whether the cache has been attached to a pool
+   *
+   * @return true Cache is bound and ready for use
+   * @return false Cache has not yet been bound
+   */
+  bool isBound() { return 0 != m_poolId; }
+
+  /**
+   * @brief Get the identifier of the pool the cache is bound to
+   *
+   * @return uint64_t Pool identifier, or 0 if unbound
+   */
+  uint64_t getPoolId() { return m_poolId; }
+
+  /**
+   * @brief Take a block from bin i, refilling the bin from its allocator when
+   * empty
+   *
+   * @param i Bin (allocator) index
+   * @param depth Configured cache depth
+   * @return MemoryBlock* Address of the block, or nullptr if the size class is
+   * exhausted
+   */
+  MemoryBlock *allocate(size_t i, size_t depth)
+  {
+    bool carved;
+    return allocate(i, depth, carved);
+  }
+
+  /**
+   * @brief Take a block from bin i, reporting whether it was carved fresh and
+   * never handed out before
+   *
+   * A bin refilled with a freshly carved chain keeps count of those blocks,
+   * which stay at its bottom while released blocks are stacked above them.
+   *
+   * @param i Bin (allocator) index
+   * @param depth Configured cache depth
+   * @param[out] carved Block was carved fresh
+   * @return MemoryBlock* Address of the block, or nullptr if the size class is
+   * exhausted
+   */
+  MemoryBlock *allocate(size_t i, size_t depth, bool &carved);
+
+  /**
+   * @brief Place a block in bin i, flushing a batch back to the allocator when
+   * the bin exceeds the cache depth
+   *
+   * @param i Bin (allocator) index
+   * @param block Block being released
+   * @param depth Configured cache depth
+   */
+  void release(size_t i, MemoryBlock *block, size_t depth);
+
+  /**
+   * @brief Count n blocks of bin i handed out by the pool
+   */
+  void countAllocations(size_t i, uint64_t n)
+  {
+    bump(m_bin[i].m_allocations, n);
+  }
+
+  /**
+   * @brief Count n blocks of bin i released to the pool
+   */
+  void countFrees(size_t i, uint64_t n) { bump(m_bin[i].m_frees, n); }
+
+  /**
+   * @brief Get the number of blocks of bin i handed out by the owning thread
+   */
+  uint64_t getAllocations(size_t i)
+  {
+    return m_bin[i].m_allocations.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Get the number of blocks of bin i released by the owning thread
+   */
+  uint64_t getFrees(size_t i)
+  {
+    return m_bin[i].m_frees.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Return every cached block to its allocator
+   */
+  void flush();
+
+  /**
+   * @brief Forget every cached block and unbind, without touching the
+   * allocators (used once the owning pool no longer exists)
+   */
+  void discard();
+
+  /** @brief Maximum number of bins (size classes) in a cache */
+  static constexpr size_t BIN_MAX = 32;
+
+private:
+  /**
+   * @brief Hand the n most recently cached blocks of bin i back to the
+   * allocator with a single exchange
+   *
+   * @param i Bin (allocator) index
+   * @param n Number of blocks to flush
+   */
+  void drain(size_t i, size_t n);
+
+  /**
+   * @brief Batch size used to refill and flush bins for a given depth
+   */
+  static size_t batchSize(size_t depth) { return (depth / 2) ? depth / 2 : 1; }
+
+  /**
+   * @brief Add to a counter of the cache; only the owning thread writes it,
+   * so a plain load and store suffice where others only read
+   */
+  static void bump(std::atomic<uint64_t> &counter, uint64_t n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+  }
+
+  /** @brief Thread-private free list for a single size class */
+  struct Bin
+  {
+    /** @brief Most recently cached block */
+    MemoryBlock *m_head{nullptr};
+    /** @brief Number of blocks held in the bin */
+    size_t m_count{0};
+    /** @brief Number of freshly carved blocks at the bottom of the bin */
+    size_t m_carved{0};
+    /** @brief Blocks handed out by the owning thread */
+    std::atomic<uint64_t> m_allocations{0};
+    /** @brief Blocks released by the owning thread */
+    std::atomic<uint64_t> m_frees{0};
+  };
+
+  /** @brief Identifier of the pool owning the allocators */
+  uint64_t m_poolId{0};
+  /** @brief Allocators backing each bin */
+  BlockAllocator *m_allocator{nullptr};
+  /** @brief Number of bins in use */
+  size_t m_nAllocators{0};
+  /** @brief Per size class caches */
+  Bin m_bin[BIN_MAX];
+};
+
+/**
+ * @struct PoolRegistration PoolRegistration
+ *
+ * Define an entry in the registry of live pools. Each pool embeds one and is
+ * assigned a unique, never reused identifier when it registers.
+ */
+struct PoolRegistration
+{
+  /** @brief Unique identifier of the pool (0 while unregistered) */
+  uint64_t m_id{0};
+  /** @brief Next entry in the registry */
+  PoolRegistration *m_next{nullptr};
+  /** @brief Blocks handed out by the caches retired while the pool lived */
+  uint64_t m_allocations[ThreadCache::BIN_MAX]{};
+  /** @brief Blocks released by the caches retired while the pool lived */
+  uint64_t m_frees[ThreadCache::BIN_MAX]{};
+};
+
+/**
+ * @class ThreadCacheTable ThreadCacheTable
+ *
+ * Define the set of thread caches held by one thread, one per pool the thread
+ * has used recently, looked up by pool identifier. A thread using more pools
+ * than there are slots evicts (flushes) the cache of another pool.
+ *
+ * Pools register themselves for their lifetime. A cache is only ever flushed
+ * back while its pool is still registered, checked under the registry lock, so
+ * a thread exiting after (or while) a pool is destroyed simply drops the blocks
+ * it cached for that pool.
+ *
+ * Every table in use is listed too, so the block counters of the caches of a
+ * pool can be summed across threads; a cache flushed for good leaves its
+ * counters with the registration of its pool.
+ */
+class ThreadCacheTable
+{
+public:
+  ThreadCacheTable() = default;
+  ~ThreadCacheTable();
+  ThreadCacheTable &operator=(const ThreadCacheTable &other) = delete;
+  ThreadCacheTable(const ThreadCacheTable &other) = delete;
+
+  /**
+   * @brief Get this thread's cache for a pool, binding a slot on first use
+   *
+   * @param poolId Unique identifier of the pool
+   * @param allocator Array of allocators of the pool
+   * @param nAllocators Number of allocators in the array
+   * @return ThreadCache& Cache bound to the pool
+   */
+  ThreadCache &get(uint64_t poolId, BlockAllocator *allocator, size_t nAllocators)
+  {
+    if (m_slot[m_last].getPoolId() == poolId)
+    {
+      return m_slot[m_last];
+    }
+    return lookup(poolId, allocator, nAllocators);
+  }
+
+  /**
+   * @brief Add a pool to the registry of live pools, assigning its identifier
+   *
+   * @param r Registration entry embedded in the pool
+   */
+  static void registerPool(PoolRegistration &r);
+
+  /**
+   * @brief Remove a pool from the registry of live pools
+   *
+   * @param r Registration entry embedded in the pool
+   */
+  static void unregisterPool(PoolRegistration &r);
+
+  /**
+   * @brief Sum the block counters of every cache of a pool, live or retired
+   *
+   * @param r Registration entry embedded in the pool
+   * @param[out] allocations Blocks handed out, per bin
+   * @param[out] frees Blocks released, per bin
+   */
+  static void countBlocks(const PoolRegistration &r,
+      uint64_t *allocations,
+      uint64_t *frees);
+
+  /** @brief Maximum number of pools cached per thread */
+  static constexpr size_t SLOT_MAX = 8;
+
+private:
+  /**
+   * @brief Find or bind the slot for a pool (slow path of get())
+   */
+  ThreadCache &lookup(uint64_t poolId,
+      BlockAllocator *allocator,
+      size_t nAllocators);
+
+  /**
+   * @brief Find the registration of a pool still registered (registry lock
+   * held)
+   *
+   * @return PoolRegistration* Registration entry, or nullptr if the pool has
+   * been destroyed
+   */
+  static PoolRegistration *findPool(uint64_t poolId);
+
+  /**
+   * @brief Flush a cache for good, leaving its counters with its pool
+   * (registry lock held)
+   */
+  static void retire(ThreadCache &cache, PoolRegistration &r);
+
+  /** @brief Caches, one per recently used pool */
+  ThreadCache m_slot[SLOT_MAX];
+  /** @brief Most recently used slot */
+  size_t m_last{0};
+  /** @brief Next slot to evict when every slot holds a live pool */
+  size_t m_victim{0};
+  /** @brief Next table in the list of tables in use */
+  ThreadCacheTable *m_next{nullptr};
+  /** @brief Flag denoting the table is in the list of tables in use */
+  bool m_listed{false};
+};
@@ -1,9 +1,89 @@
 #include <pool_alloc.h>
 
+#include <fstream>
+#include <new>
 #include "MemoryPool.hpp"
 
 static MemoryPool *s_pool = nullptr;
 
+static MemoryPool *toPool(pool_t *pool)
+{
+  return reinterpret_cast<MemoryPool *>(pool);
+}
+
+static PoolConfig toPoolConfig(const pool_config_t *config)
+{
+  PoolConfig c;
+  c.blockSizes = config->block_sizes;
+  c.nSizes = config->block_size_count;
+  c.heapBytes = config->heap_bytes;
+  c.heapFlags = config->heap_flags;
+  c.heapMemory = config->heap_memory;
+  c.blockCounts = config->block_counts;
+  c.byteBudgets = config->byte_budgets;
+  c.overflow = config->overflow_policy;
+  c.borrowLimit = config->borrow_limit;
+  c.overflowHeap = toPool(config->overflow_pool);
+  c.trim = config->trim_policy;
+  c.trimInterval = config->trim_interval_ms;
+  return c;
+}
+
+static void *callocFrom(MemoryPool *pool, size_t count, size_t size)
+{
+  size_t n = 0;
+  return __builtin_mul_overflow(count, size, &n) ? nullptr
+                                                 : pool->allocateZeroed(n);
+}
+
+static bool toPoolStats(MemoryPool *pool, pool_stats_t *stats)
+{
+  if (!pool || !pool->isInitialized())
+  {
+    return false;
+  }
+
+  PoolStats s = pool->getStats();
+  stats->class_count = s.nClasses;
+  for (size_t i = 0; i < s.nClasses; ++i)
+  {
+    const PoolClassStats &c = s.classes[i];
+    pool_class_stats_t &out = stats->classes[i];
+    out.block_size = c.blockSize;
+    out.block_count = c.blockCount;
+    out.in_use = c.inUse;
+    out.high_water = c.highWater;
+    out.allocations = c.allocations;
+    out.frees = c.frees;
+    out.failures = c.failures;
+    out.fall_throughs = c.fallThroughs;
+    out.overflows = c.overflows;
+    out.contention = c.contention;
+    out.trimmed_bytes = c.trimmedBytes;
+  }
+  stats->oversize = s.oversize;
+  stats->overflows = s.overflows;
+  stats->overflow_frees = s.overflowFrees;
+  return true;
+}
+
+static_assert(POOL_HEAP_HUGETLB == PoolHeap::HEAP_HUGETLB &&
+                  POOL_HEAP_THP == PoolHeap::HEAP_THP,
+    "C and C++ heap flags must agree");
+static_assert(POOL_OVERFLOW_BORROW == PoolConfig::OVERFLOW_BORROW &&
+                  POOL_OVERFLOW_FAIL == PoolConfig::OVERFLOW_FAIL &&
+                  POOL_OVERFLOW_HEAP == PoolConfig::OVERFLOW_HEAP &&
+                  POOL_OVERFLOW_MALLOC == PoolConfig::OVERFLOW_MALLOC,
+    "C and C++ overflow policies must agree");
+static_assert(POOL_TRIM_DONTNEED == PoolConfig::TRIM_DONTNEED &&
+                  POOL_TRIM_FREE == PoolConfig::TRIM_FREE,
+    "C and C++ trim policies must agree");
+static_assert(POOL_SAMPLE_TEXT == PoolSampler::FORMAT_TEXT &&
+                  POOL_SAMPLE_PPROF == PoolSampler::FORMAT_PPROF,
+    "C and C++ sample formats must agree");
+static_assert(POOL_STATS_CLASS_MAX == PoolStats::CLASS_MAX,
+    "C and C++ statistics must agree");
+
 extern "C"
 {
   bool pool_init(const size_t *block_sizes, size_t block_size_count)
@@ -12,7 +92,132 @@ extern "C"
     return s_pool->isInitialized();
   }
 
+  bool pool_init_config(const pool_config_t *config)
+  {
+    s_pool = &MemoryPool::getPool(toPoolConfig(config));
+    return s_pool->isInitialized();
+  }
+
   void *pool_malloc(size_t n) { return s_pool->allocate(n); }
 
+  void *pool_calloc(size_t count, size_t size)
+  {
+    return callocFrom(s_pool, count, size);
+  }
+
+  void *pool_aligned_alloc(size_t alignment, size_t n)
+  {
+    return s_pool->allocate(n, alignment);
+  }
+
   void pool_free(void *ptr) { s_pool->release(ptr); }
+
+  void pool_free_sized(void *ptr, size_t n) { s_pool->release(ptr, n); }
+
+  void *pool_realloc(void *ptr, size_t n) { return s_pool->reallocate(ptr, n); }
+
+  size_t pool_usable_size(const void *ptr) { return s_pool->usableSize(ptr); }
+
+  size_t pool_malloc_bulk(size_t n, size_t count, void **out)
+  {
+    return s_pool->allocateBulk(n, count, out);
+  }
+
+  void pool_free_bulk(void **ptrs, size_t count)
+  {
+    s_pool->releaseBulk(ptrs, count);
+  }
+
+  bool pool_get_stats(pool_stats_t *stats)
+  {
+    return toPoolStats(s_pool, stats);
+  }
+
+  void pool_set_cache_depth(size_t depth) { s_pool->setCacheDepth(depth); }
+
+  size_t pool_trim(void) { return s_pool->trim(); }
+
+  bool pool_set_sample_rate(size_t bytes)
+  {
+    return s_pool->setSampleRate(bytes);
+  }
+
+  size_t pool_dump_samples(const char *path, unsigned format)
+  {
+    std::ofstream file(path, std::ios::trunc);
+    return file ? s_pool->dumpSamples(file, format) : 0;
+  }
+
+  pool_t *pool_create(const size_t *block_sizes, size_t block_size_count)
+  {
+    pool_config_t config = {};
+    config.block_sizes = block_sizes;
+    config.block_size_count = block_size_count;
+    return pool_create_config(&config);
+  }
+
+  pool_t *pool_create_config(const pool_config_t *config)
+  {
+    auto pool = new (std::nothrow) MemoryPool(toPoolConfig(config));
+    if (pool && !pool->isInitialized())
+    {
+      delete pool;
+      pool = nullptr;
+    }
+    return reinterpret_cast<pool_t *>(pool);
+  }
+
+  void pool_destroy(pool_t *pool) { delete toPool(pool); }
+
+  void *pool_malloc_from(pool_t *pool, size_t n)
+  {
+    return toPool(pool)->allocate(n);
+  }
+
+  void *pool_calloc_from(pool_t *pool, size_t count, size_t size)
+  {
+    return callocFrom(toPool(pool), count, size);
+  }
+
+  void *pool_aligned_alloc_from(pool_t *pool, size_t alignment, size_t n)
+  {
+    return toPool(pool)->allocate(n, alignment);
+  }
+
+  void pool_free_to(pool_t *pool, void *ptr) { toPool(pool)->release(ptr); }
+
+  void pool_free_sized_to(pool_t *pool, void *ptr, size_t n)
+  {
+    toPool(pool)->release(ptr, n);
+  }
+
+  void *pool_realloc_from(pool_t *pool, void *ptr, size_t n)
+  {
+    return toPool(pool)->reallocate(ptr, n);
+  }
+
+  size_t pool_usable_size_from(pool_t *pool, const void *ptr)
+  {
+    return toPool(pool)->usableSize(ptr);
+  }
+
+  size_t pool_malloc_bulk_from(pool_t *pool,
+      size_t n,
+      size_t count,
+      void **out)
+  {
+    return toPool(pool)->allocateBulk(n, count, out);
+  }
+
+  void pool_free_bulk_to(pool_t *pool, void **ptrs, size_t count)
+  {
+    toPool(pool)->releaseBulk(ptrs, count);
+  }
+
+  bool pool_get_stats_from(pool_t *pool, pool_stats_t *stats)
+  {
+    return toPoolStats(toPool(pool), stats);
+  }
+
+  size_t pool_trim_from(pool_t *pool) { return toPool(pool)->trim(); }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -17,6 +18,82 @@ extern "C"
    */
   bool pool_init(const size_t *block_sizes, size_t block_size_count);
 
+/** @brief Default pages backing the pool heap */
+#define POOL_HEAP_DEFAULT 0x0u
+/** @brief Back the pool heap with explicit huge pages (MAP_HUGETLB) */
+#define POOL_HEAP_HUGETLB 0x1u
+/** @brief Align and advise the pool heap for transparent huge pages */
+#define POOL_HEAP_THP 0x2u
+
+/** @brief Exhausted block sizes borrow from larger ones (up to borrow_limit) */
+#define POOL_OVERFLOW_BORROW 0x0u
+/** @brief Exhausted block sizes fail the request */
+#define POOL_OVERFLOW_FAIL 0x1u
+/** @brief Exhausted block sizes allocate from overflow_pool */
+#define POOL_OVERFLOW_HEAP 0x2u
+/** @brief Exhausted block sizes allocate with malloc, freed by pool_free */
+#define POOL_OVERFLOW_MALLOC 0x3u
+
+/** @brief Trimmed pages are released at once (MADV_DONTNEED) */
+#define POOL_TRIM_DONTNEED 0x0u
+/** @brief Trimmed pages are released under memory pressure (MADV_FREE) */
+#define POOL_TRIM_FREE 0x1u
+
+/** @brief pool_dump_samples() writes one line per sample, for people */
+#define POOL_SAMPLE_TEXT 0x0u
+/** @brief pool_dump_samples() writes a legacy heap profile, read by pprof */
+#define POOL_SAMPLE_PPROF 0x1u
+
+  /**
+   * @brief Runtime configuration of the pool allocator. Zeroed fields select
+   * the default behavior.
+   */
+  typedef struct pool_config
+  {
+    /** @brief Array of block sizes to configure in pool */
+    const size_t *block_sizes;
+    /** @brief Number of block sizes in the size array */
+    size_t block_size_count;
+    /** @brief Number of bytes in the pool heap (0 selects the default, or
+     * the sum of the budgets when every block size has one) */
+    size_t heap_bytes;
+    /** @brief POOL_HEAP_* flags selecting the pages backing the heap */
+    unsigned heap_flags;
+    /** @brief Caller-owned memory of heap_bytes bytes to use as the heap
+     * (NULL maps the heap); must outlive the pool, and is never trimmed */
+    void *heap_memory;
+    /** @brief Optional number of blocks for each block size, in the order
+     * of block_sizes (0 entries fall back to byte_budgets) */
+    const size_t *block_counts;
+    /** @brief Optional heap bytes for each block size, in the order of
+     * block_sizes; sizes with neither share the rest of the heap equally */
+    const size_t *byte_budgets;
+    /** @brief POOL_OVERFLOW_* policy for requests finding their block size
+     * exhausted; only POOL_OVERFLOW_HEAP and POOL_OVERFLOW_MALLOC also serve
+     * requests larger than the largest block size */
+    unsigned overflow_policy;
+    /** @brief Number of larger block sizes a request may borrow from under
+     * POOL_OVERFLOW_BORROW (0 for all of them) */
+    size_t borrow_limit;
+    /** @brief Pool serving requests under POOL_OVERFLOW_HEAP; must outlive
+     * this pool */
+    struct pool *overflow_pool;
+    /** @brief POOL_TRIM_* policy releasing the pages trimmed by pool_trim() */
+    unsigned trim_policy;
+    /** @brief Period in milliseconds of a background thread trimming the
+     * pool whenever memory was freed since its previous pass (0 for none) */
+    unsigned trim_interval_ms;
+  } pool_config_t;
+
+  /**
+   * @brief Initialize the pool allocator from a full configuration
+   *
+   * @param config Pool configuration
+   * @return true Pool successfully initialzed
+   * @return false Error initializing pool
+   */
+  bool pool_init_config(const pool_config_t *config);
+
   /**
    * @brief Allocate n bytes from pool
    *
@@ -25,6 +102,29 @@ extern "C"
    */
   void *pool_malloc(size_t n);
 
+  /**
+   * @brief Allocate zeroed memory for count elements of size bytes from pool
+   *
+   * Blocks handed out for the first time from a zero filled heap are not
+   * cleared again.
+   *
+   * @param count Number of elements
+   * @param size Number of bytes in each element
+   * @return void* Pointer to zeroed memory, or NULL if unavailable or
+   * count * size overflows
+   */
+  void *pool_calloc(size_t count, size_t size);
+
+  /**
+   * @brief Allocate n bytes from pool aligned to alignment bytes, using a
+   * block size whose blocks are naturally aligned
+   *
+   * @param alignment Alignment, a power of 2
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to allocated memory, or NULL if unavailable
+   */
+  void *pool_aligned_alloc(size_t alignment, size_t n);
+
   /**
    * @brief Release allocation pointed to by ptr
    *
@@ -32,6 +132,297 @@ extern "C"
    */
   void pool_free(void *ptr);
 
+  /**
+   * @brief Release allocation pointed to by ptr, given the size it was
+   * allocated with, skipping the search for the owning block size
+   *
+   * @param ptr Pointer to memory to release back to the pool
+   * @param n Number of bytes passed to pool_malloc for this allocation
+   */
+  void pool_free_sized(void *ptr, size_t n);
+
+  /**
+   * @brief Resize an allocation. The memory stays in place while its block
+   * holds n bytes (unless a block at most half its size would do), and is
+   * moved to a block of the right size otherwise.
+   *
+   * @param ptr Pointer to memory to resize (NULL to allocate)
+   * @param n Number of bytes needed (0 to release the memory)
+   * @return void* Pointer to the resized memory, or NULL if unavailable (ptr
+   * is then left untouched) or n is 0
+   */
+  void *pool_realloc(void *ptr, size_t n);
+
+  /**
+   * @brief Get the number of bytes usable in an allocation, which may be
+   * written without resizing it
+   *
+   * @param ptr Pointer to memory allocated from the pool
+   * @return size_t Usable bytes, or 0 if ptr was not allocated from the pool
+   */
+  size_t pool_usable_size(const void *ptr);
+
+  /**
+   * @brief Allocate count blocks of n bytes from pool at once, taking each
+   * block size's share with a single operation on its free list
+   *
+   * @param n Number of bytes in each allocation
+   * @param count Number of allocations wanted
+   * @param out Array of at least count pointers receiving the allocations
+   * @return size_t Number of allocations made, less than count if the pool
+   * runs out
+   */
+  size_t pool_malloc_bulk(size_t n, size_t count, void **out);
+
+  /**
+   * @brief Release count allocations at once, returning each block size's
+   * share with a single operation on its free list
+   *
+   * @param ptrs Array of pointers to memory to release back to the pool
+   * @param count Number of pointers in the array
+   */
+  void pool_free_bulk(void **ptrs, size_t count);
+
+/** @brief Maximum number of block sizes reported by pool_get_stats() */
+#define POOL_STATS_CLASS_MAX 32
+
+  /**
+   * @brief Usage counters of one block size
+   */
+  typedef struct pool_class_stats
+  {
+    /** @brief Size of the blocks */
+    size_t block_size;
+    /** @brief Number of blocks carved for the block size */
+    size_t block_count;
+    /** @brief Blocks currently allocated (not counting thread caches) */
+    uint64_t in_use;
+    /** @brief Largest number of blocks allocated or held by thread caches at
+     * once */
+    uint64_t high_water;
+    /** @brief Blocks allocated since the pool was created */
+    uint64_t allocations;
+    /** @brief Blocks freed since the pool was created */
+    uint64_t frees;
+    /** @brief Requests for the block size that could not be served */
+    uint64_t failures;
+    /** @brief Requests for the block size served by a larger block size */
+    uint64_t fall_throughs;
+    /** @brief Requests for the block size served by the overflow */
+    uint64_t overflows;
+    /** @brief Free list operations retried after losing a race */
+    uint64_t contention;
+    /** @brief Heap bytes trimmed and not reused since */
+    size_t trimmed_bytes;
+  } pool_class_stats_t;
+
+  /**
+   * @brief Usage counters of a pool
+   */
+  typedef struct pool_stats
+  {
+    /** @brief Number of block sizes in the pool */
+    size_t class_count;
+    /** @brief Counters of each block size, in ascending size */
+    pool_class_stats_t classes[POOL_STATS_CLASS_MAX];
+    /** @brief Requests larger than the largest block size */
+    uint64_t oversize;
+    /** @brief Requests served by the overflow pool or malloc */
+    uint64_t overflows;
+    /** @brief Overflow allocations freed */
+    uint64_t overflow_frees;
+  } pool_stats_t;
+
+  /**
+   * @brief Take a snapshot of the usage counters of the pool. The counters
+   * are always on and cost a relaxed atomic increment per malloc or free.
+   *
+   * @param stats Snapshot filled in
+   * @return true Snapshot taken
+   * @return false Pool not initialized
+   */
+  bool pool_get_stats(pool_stats_t *stats);
+
+  /**
+   * @brief Set the number of free blocks each thread may cache per block size
+   *
+   * @param depth Maximum number of cached blocks per block size per thread;
+   * zero sends every allocation and release to the shared pool
+   */
+  void pool_set_cache_depth(size_t depth);
+
+  /**
+   * @brief Return heap pages holding only freed memory to the operating
+   * system. The pages are reused (and faulted back in) once a block size has
+   * no other free memory left. Memory cached by other threads keeps its pages.
+   * Only heaps the pool mapped itself are trimmed. Every free page is trimmed,
+   * however fragmented the heap; pages still trimmed by an earlier call are
+   * skipped. Allocations keep being served while a trim runs.
+   *
+   * @return size_t Heap bytes returned to the operating system by this call
+   */
+  size_t pool_trim(void);
+
+  /**
+   * @brief Sample one in about every bytes bytes allocated from pool,
+   * recording the size class and call stack of each sample until its memory
+   * is released
+   *
+   * @param bytes Mean number of bytes allocated between samples (0 disables
+   * sampling)
+   * @return true Sampling rate set
+   * @return false The sampler could not be created
+   */
+  bool pool_set_sample_rate(size_t bytes);
+
+  /**
+   * @brief Write the sampled allocations still live to a file
+   *
+   * @param path File to write, replaced if it exists
+   * @param format POOL_SAMPLE_* format of the file
+   * @return size_t Number of live samples written, 0 if none or the file could
+   * not be written
+   */
+  size_t pool_dump_samples(const char *path, unsigned format);
+
+  /** @brief Opaque handle to an independent pool */
+  typedef struct pool pool_t;
+
+  /**
+   * @brief Create a pool independent of the global pool and of any other pool
+   *
+   * @param block_sizes Array of block sizes to configure in pool
+   * @param block_size_count Number of block sizes in the size array
+   * @return pool_t* Handle to the new pool, or NULL on error
+   */
+  pool_t *pool_create(const size_t *block_sizes, size_t block_size_count);
+
+  /**
+   * @brief Create an independent pool from a full configuration
+   *
+   * @param config Pool configuration
+   * @return pool_t* Handle to the new pool, or NULL on error
+   */
+  pool_t *pool_create_config(const pool_config_t *config);
+
+  /**
+   * @brief Destroy a pool, releasing its heap. Every allocation from the pool
+   * becomes invalid and no thread may use the pool afterward.
+   *
+   * @param pool Handle to the pool (NULL is ignored)
+   */
+  void pool_destroy(pool_t *pool);
+
+  /**
+   * @brief Allocate n bytes from a pool
+   *
+   * @param pool Handle to the pool
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to allocated memory, or NULL if unavailable
+   */
+  void *pool_malloc_from(pool_t *pool, size_t n);
+
+  /**
+   * @brief Allocate zeroed memory for count elements of size bytes from a pool
+   *
+   * @param pool Handle to the pool
+   * @param count Number of elements
+   * @param size Number of bytes in each element
+   * @return void* Pointer to zeroed memory, or NULL if unavailable or
+   * count * size overflows
+   */
+  void *pool_calloc_from(pool_t *pool, size_t count, size_t size);
+
+  /**
+   * @brief Allocate n bytes from a pool aligned to alignment bytes
+   *
+   * @param pool Handle to the pool
+   * @param alignment Alignment, a power of 2
+   * @param n Number of bytes to allocate
+   * @return void* Pointer to allocated memory, or NULL if unavailable
+   */
+  void *pool_aligned_alloc_from(pool_t *pool, size_t alignment, size_t n);
+
+  /**
+   * @brief Release allocation pointed to by ptr back to a pool
+   *
+   * @param pool Handle to the pool the memory was allocated from
+   * @param ptr Pointer to memory to release back to the pool
+   */
+  void pool_free_to(pool_t *pool, void *ptr);
+
+  /**
+   * @brief Release allocation pointed to by ptr back to a pool, given the
+   * size it was allocated with
+   *
+   * @param pool Handle to the pool the memory was allocated from
+   * @param ptr Pointer to memory to release back to the pool
+   * @param n Number of bytes passed to pool_malloc_from for this allocation
+   */
+  void pool_free_sized_to(pool_t *pool, void *ptr, size_t n);
+
+  /**
+   * @brief Resize an allocation of a pool
+   *
+   * @param pool Handle to the pool the memory was allocated from
+   * @param ptr Pointer to memory to resize (NULL to allocate)
+   * @param n Number of bytes needed (0 to release the memory)
+   * @return void* Pointer to the resized memory, or NULL if unavailable (ptr
+   * is then left untouched) or n is 0
+   */
+  void *pool_realloc_from(pool_t *pool, void *ptr, size_t n);
+
+  /**
+   * @brief Get the number of bytes usable in an allocation of a pool
+   *
+   * @param pool Handle to the pool the memory was allocated from
+   * @param ptr Pointer to memory allocated from the pool
+   * @return size_t Usable bytes, or 0 if ptr was not allocated from the pool
+   */
+  size_t pool_usable_size_from(pool_t *pool, const void *ptr);
+
+  /**
+   * @brief Allocate count blocks of n bytes from a pool at once
+   *
+   * @param pool Handle to the pool
+   * @param n Number of bytes in each allocation
+   * @param count Number of allocations wanted
+   * @param out Array of at least count pointers receiving the allocations
+   * @return size_t Number of allocations made
+   */
+  size_t pool_malloc_bulk_from(pool_t *pool,
+      size_t n,
+      size_t count,
+      void **out);
+
+  /**
+   * @brief Release count allocations back to a pool at once
+   *
+   * @param pool Handle to the pool the memory was allocated from
+   * @param ptrs Array of pointers to memory to release back to the pool
+   * @param count Number of pointers in the array
+   */
+  void pool_free_bulk_to(pool_t *pool, void **ptrs, size_t count);
+
+  /**
+   * @brief Take a snapshot of the usage counters of a pool
+   *
+   * @param pool Handle to the pool
+   * @param stats Snapshot filled in
+   * @return true Snapshot taken
+   * @return false Pool not initialized
+   */
+  bool pool_get_stats_from(pool_t *pool, pool_stats_t *stats);
+
+  /**
+   * @brief Return heap pages of a pool holding only freed memory to the
+   * operating system
+   *
+   * @param pool Handle to the pool
+   * @return size_t Heap bytes returned to the operating system
+   */
+  size_t pool_trim_from(pool_t *pool);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
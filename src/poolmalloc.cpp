@@ -0,0 +1,513 @@
+/**
+ * malloc interposition library backed by a MemoryPool (libpoolmalloc.so).
+ *
+ * Preloading the library (LD_PRELOAD=libpoolmalloc.so) serves the malloc
+ * family of unmodified programs from a pool: requests that fit the configured
+ * block sizes come from the pool, everything else (and anything the pool runs
+ * out of) is forwarded to the next allocator, found with dlsym(RTLD_NEXT).
+ * free() and friends route pointers back by address.
+ *
+ * The pool is created on the first call, configured from the environment:
+ *  - POOL_MALLOC_SIZES: comma separated block sizes (default 16 to 1024 in
+ *    quarter steps, plus 2048 and 4096), each rounded up to a multiple of
+ *    alignof(max_align_t) so every block keeps the alignment malloc promises
+ *  - POOL_MALLOC_HEAP_BYTES: heap size (default 64 MiB, mapped lazily)
+ *  - POOL_MALLOC_HEAP_FLAGS: PoolHeap::Flags for the heap pages
+ *  - POOL_MALLOC_CACHE_DEPTH: per-thread cache depth
+ *  - POOL_MALLOC_TRIM_MS: period of a background thread returning free heap
+ *    pages to the OS (default 0, none); malloc_trim() trims on demand
+ *  - POOL_MALLOC_SAMPLE_BYTES: sample one allocation in about this many bytes
+ *    (default 0, none), recording its size class and call stack
+ *  - POOL_MALLOC_PROFILE: file receiving the samples still live at exit, as a
+ *    heap profile read by pprof
+ *  - POOL_MALLOC_DISABLE: forward every request when set to a non-zero value
+ *
+ * Anything the pool itself allocates while serving a call (thread-local
+ * registration, for instance) is caught by a per-thread guard and forwarded,
+ * and the few allocations dlsym makes before the next allocator is known are
+ * served from a small static arena.
+ */
+#include <dlfcn.h>
+#include <malloc.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include "MemoryPool.hpp"
+
+namespace
+{
+/** @brief Entry points of the allocator the library forwards to */
+struct NextAllocator
+{
+  void *(*m_malloc)(size_t);
+  void (*m_free)(void *);
+  void *(*m_calloc)(size_t, size_t);
+  void *(*m_realloc)(void *, size_t);
+  int (*m_posixMemalign)(void **, size_t, size_t);
+  size_t (*m_usableSize)(void *);
+  int (*m_trim)(size_t);
+};
+
+/** @brief Progress of a one-time setup step */
+enum Setup : int
+{
+  SETUP_NONE,
+  SETUP_RUNNING,
+  SETUP_DONE,
+};
+
+/** @brief Alignment of every block handed out by malloc */
+constexpr size_t MALLOC_ALIGN = alignof(std::max_align_t);
+/** @brief Maximum number of block sizes read from the environment */
+constexpr size_t SIZE_MAX_COUNT = 32;
+/** @brief Default heap size */
+constexpr size_t HEAP_BYTES_DEFAULT = size_t(64) << 20;
+/** @brief Bytes of the arena serving allocations made by dlsym */
+constexpr size_t BOOTSTRAP_BYTES = 16384;
+/** @brief Bytes in front of each arena allocation, holding its size */
+constexpr size_t BOOTSTRAP_HEADER = 16;
+
+const size_t s_defaultSizes[] = {16, 32, 48, 64, 80, 96, 112, 128, 160, 192,
+    224, 256, 320, 384, 448, 512, 640, 768, 896, 1024, 2048, 4096};
+
+NextAllocator s_next;
+std::atomic<int> s_nextSetup{SETUP_NONE};
+
+alignas(MemoryPool) unsigned char s_poolStorage[sizeof(MemoryPool)];
+std::atomic<MemoryPool *> s_pool{nullptr};
+std::atomic<int> s_poolSetup{SETUP_NONE};
+
+alignas(16) unsigned char s_bootstrap[BOOTSTRAP_BYTES];
+std::atomic<size_t> s_bootstrapUsed{0};
+
+/** @brief Set while this thread is inside the pool or resolving symbols */
+thread_local bool t_busy = false;
+
+/**
+ * @brief Serve an allocation from the static arena (never freed)
+ */
+void *bootstrapAlloc(size_t n)
+{
+  size_t bytes = BOOTSTRAP_HEADER + ((n + 15) & ~size_t(15));
+  size_t used = s_bootstrapUsed.fetch_add(bytes, std::memory_order_relaxed);
+  if (used + bytes > BOOTSTRAP_BYTES)
+  {
+    return nullptr;
+  }
+  *reinterpret_cast<size_t *>(&s_bootstrap[used]) = n;
+  return &s_bootstrap[used + BOOTSTRAP_HEADER];
+}
+
+bool isBootstrap(const void *p)
+{
+  return (reinterpret_cast<uintptr_t>(p) -
+             reinterpret_cast<uintptr_t>(s_bootstrap)) < BOOTSTRAP_BYTES;
+}
+
+size_t bootstrapSize(const void *p)
+{
+  return *reinterpret_cast<const size_t *>(
+      static_cast<const unsigned char *>(p) - BOOTSTRAP_HEADER);
+}
+
+template <typename F>
+void resolve(F &fn, const char *name)
+{
+  fn = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+/**
+ * @brief Get the next allocator, resolving it on first use
+ *
+ * @return const NextAllocator* Next allocator, or nullptr while this thread
+ * is resolving it
+ */
+const NextAllocator *next()
+{
+  if (SETUP_DONE == s_nextSetup.load(std::memory_order_acquire))
+  {
+    return &s_next;
+  }
+
+  int state = SETUP_NONE;
+  if (s_nextSetup.compare_exchange_strong(state, SETUP_RUNNING,
+          std::memory_order_acquire))
+  {
+    bool busy = t_busy;
+    t_busy = true;
+    resolve(s_next.m_malloc, "malloc");
+    resolve(s_next.m_free, "free");
+    resolve(s_next.m_calloc, "calloc");
+    resolve(s_next.m_realloc, "realloc");
+    resolve(s_next.m_posixMemalign, "posix_memalign");
+    resolve(s_next.m_usableSize, "malloc_usable_size");
+    resolve(s_next.m_trim, "malloc_trim");
+    t_busy = busy;
+    s_nextSetup.store(SETUP_DONE, std::memory_order_release);
+    return &s_next;
+  }
+
+  // dlsym allocating on the resolving thread falls back to the arena, while
+  // other threads wait for the symbols
+  if (t_busy)
+  {
+    return nullptr;
+  }
+  while (SETUP_DONE != s_nextSetup.load(std::memory_order_acquire))
+  {
+  }
+  return &s_next;
+}
+
+/**
+ * @brief Read an unsigned number from the environment
+ */
+size_t envSize(const char *name, size_t fallback)
+{
+  const char *value = getenv(name);
+  return (value && *value) ? strtoull(value, nullptr, 0) : fallback;
+}
+
+/**
+ * @brief Write the live samples to POOL_MALLOC_PROFILE at exit
+ */
+void dumpProfile()
+{
+  // The profile is written with the next allocator, leaving the pool as is
+  bool busy = t_busy;
+  t_busy = true;
+  std::ofstream file(getenv("POOL_MALLOC_PROFILE"), std::ios::trunc);
+  if (file)
+  {
+    s_pool.load(std::memory_order_acquire)
+        ->dumpSamples(file, PoolSampler::FORMAT_PPROF);
+  }
+  t_busy = busy;
+}
+
+/**
+ * @brief Create the pool from the environment (first caller only)
+ */
+void createPool()
+{
+  static size_t sizes[SIZE_MAX_COUNT];
+  size_t nSizes = 0;
+
+  const char *list = getenv("POOL_MALLOC_SIZES");
+  if (list && *list)
+  {
+    char *end = nullptr;
+    while (*list && (nSizes < SIZE_MAX_COUNT))
+    {
+      // Sizes the rounding makes equal are only added once
+      size_t size = (strtoull(list, &end, 0) + MALLOC_ALIGN - 1) &
+                    ~(MALLOC_ALIGN - 1);
+      bool seen = false;
+      for (size_t i = 0; i < nSizes; ++i)
+      {
+        seen = seen || (sizes[i] == size);
+      }
+      sizes[nSizes] = size;
+      nSizes += !seen;
+      list = (*end == ',') ? end + 1 : end;
+      if (end == list)
+      {
+        break;
+      }
+    }
+  }
+  else
+  {
+    for (auto size : s_defaultSizes)
+    {
+      sizes[nSizes++] = size;
+    }
+  }
+
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = nSizes;
+  config.heapBytes = envSize("POOL_MALLOC_HEAP_BYTES", HEAP_BYTES_DEFAULT);
+  config.heapFlags = static_cast<unsigned>(
+      envSize("POOL_MALLOC_HEAP_FLAGS", PoolHeap::HEAP_DEFAULT));
+  config.trimInterval =
+      static_cast<unsigned>(envSize("POOL_MALLOC_TRIM_MS", 0));
+
+  // The pool lives until the process exits, so it is never destroyed
+  auto pool = new (s_poolStorage) MemoryPool(config);
+  if (pool->isInitialized())
+  {
+    const char *depth = getenv("POOL_MALLOC_CACHE_DEPTH");
+    if (depth && *depth)
+    {
+      pool->setCacheDepth(strtoull(depth, nullptr, 0));
+    }
+    const char *profile = getenv("POOL_MALLOC_PROFILE");
+    if (pool->setSampleRate(envSize("POOL_MALLOC_SAMPLE_BYTES", 0)) &&
+        pool->getSampleRate() && profile && *profile)
+    {
+      atexit(dumpProfile);
+    }
+    s_pool.store(pool, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Get the pool, creating it on first use
+ *
+ * @return MemoryPool* Pool, or nullptr if it is disabled, failed, still being
+ * created, or this thread is already inside it
+ */
+MemoryPool *pool()
+{
+  if (t_busy)
+  {
+    return nullptr;
+  }
+
+  MemoryPool *p = s_pool.load(std::memory_order_acquire);
+  if (p || (SETUP_DONE == s_poolSetup.load(std::memory_order_acquire)))
+  {
+    return p;
+  }
+
+  // Requests made while another thread creates the pool are forwarded
+  int state = SETUP_NONE;
+  if (s_poolSetup.compare_exchange_strong(state, SETUP_RUNNING,
+          std::memory_order_acquire))
+  {
+    t_busy = true;
+    if (0 == envSize("POOL_MALLOC_DISABLE", 0))
+    {
+      createPool();
+    }
+    t_busy = false;
+    s_poolSetup.store(SETUP_DONE, std::memory_order_release);
+  }
+  return s_pool.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Get the pool owning an address, if any
+ */
+MemoryPool *ownerOf(const void *p)
+{
+  MemoryPool *owner = s_pool.load(std::memory_order_acquire);
+  return (owner && owner->owns(p)) ? owner : nullptr;
+}
+
+void *nextMalloc(size_t n)
+{
+  auto na = next();
+  return na ? na->m_malloc(n) : bootstrapAlloc(n);
+}
+
+void *poolAllocate(MemoryPool *pool, size_t n, size_t align)
+{
+  // Any requested alignment, however small, is honoured by the pool; a block
+  // only as large as n may be less aligned than the caller asked for
+  t_busy = true;
+  void *p = align ? pool->allocate(n, align) : pool->allocate(n);
+  t_busy = false;
+  return p;
+}
+
+/**
+ * @brief Serve an aligned allocation from the pool, or forward it
+ *
+ * @param align Alignment, a power of 2 no smaller than a pointer
+ * @param n Number of bytes
+ * @param[out] out Allocation
+ * @return int 0, or ENOMEM when neither the pool nor the next allocator has
+ * the memory
+ */
+int alignedAllocate(size_t align, size_t n, void **out)
+{
+  MemoryPool *pl = pool();
+  void *p = pl ? poolAllocate(pl, n, align) : nullptr;
+  if (p)
+  {
+    *out = p;
+    return 0;
+  }
+  auto na = next();
+  return na ? na->m_posixMemalign(out, align, n) : ENOMEM;
+}
+
+void poolRelease(MemoryPool *pool, void *p)
+{
+  bool busy = t_busy;
+  t_busy = true;
+  pool->release(p);
+  t_busy = busy;
+}
+} // namespace
+
+extern "C"
+{
+  void *malloc(size_t n)
+  {
+    MemoryPool *pl = pool();
+    void *p = pl ? poolAllocate(pl, n, 0) : nullptr;
+    return p ? p : nextMalloc(n);
+  }
+
+  void free(void *p)
+  {
+    if (!p || isBootstrap(p))
+    {
+      return;
+    }
+    if (MemoryPool *owner = ownerOf(p))
+    {
+      poolRelease(owner, p);
+      return;
+    }
+    if (auto na = next())
+    {
+      na->m_free(p);
+    }
+  }
+
+  void *calloc(size_t count, size_t size)
+  {
+    size_t n = 0;
+    if (__builtin_mul_overflow(count, size, &n))
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+
+    MemoryPool *pl = pool();
+    void *p = nullptr;
+    if (pl)
+    {
+      t_busy = true;
+      p = pl->allocateZeroed(n);
+      t_busy = false;
+    }
+    if (p)
+    {
+      return p;
+    }
+
+    // The arena is static storage, so it is already zero
+    auto na = next();
+    return na ? na->m_calloc(count, size) : bootstrapAlloc(n);
+  }
+
+  void *realloc(void *p, size_t n)
+  {
+    if (!p)
+    {
+      return malloc(n);
+    }
+    if (0 == n)
+    {
+      free(p);
+      return nullptr;
+    }
+
+    // Pool blocks are resized by the pool, and only move to the next
+    // allocator once the pool has no block large enough
+    if (MemoryPool *owner = ownerOf(p))
+    {
+      t_busy = true;
+      void *q = owner->reallocate(p, n);
+      size_t usable = q ? 0 : owner->usableSize(p);
+      t_busy = false;
+      if (!q && (q = nextMalloc(n)))
+      {
+        memcpy(q, p, usable);
+        free(p);
+      }
+      return q;
+    }
+
+    // Arena blocks keep growing in place up to their size, and are moved
+    // otherwise
+    if (isBootstrap(p))
+    {
+      size_t usable = bootstrapSize(p);
+      if (n <= usable)
+      {
+        return p;
+      }
+      void *q = malloc(n);
+      if (q)
+      {
+        memcpy(q, p, usable);
+        free(p);
+      }
+      return q;
+    }
+    auto na = next();
+    return na ? na->m_realloc(p, n) : nullptr;
+  }
+
+  int posix_memalign(void **out, size_t align, size_t n)
+  {
+    if (!align || (align & (align - 1)) || (align % sizeof(void *)))
+    {
+      return EINVAL;
+    }
+    return alignedAllocate(align, n, out);
+  }
+
+  void *aligned_alloc(size_t align, size_t n)
+  {
+    if (!align || (align & (align - 1)))
+    {
+      errno = EINVAL;
+      return nullptr;
+    }
+
+    // Smaller alignments are met by any block a pointer can be stored in
+    void *p = nullptr;
+    int error = alignedAllocate(
+        (align < sizeof(void *)) ? sizeof(void *) : align, n, &p);
+    errno = error ? error : errno;
+    return error ? nullptr : p;
+  }
+
+  void *memalign(size_t align, size_t n) { return aligned_alloc(align, n); }
+
+  size_t malloc_usable_size(void *p)
+  {
+    if (!p)
+    {
+      return 0;
+    }
+    if (isBootstrap(p))
+    {
+      return bootstrapSize(p);
+    }
+    if (MemoryPool *owner = ownerOf(p))
+    {
+      return owner->usableSize(p);
+    }
+    auto na = next();
+    return na ? na->m_usableSize(p) : 0;
+  }
+
+  int malloc_trim(size_t pad)
+  {
+    size_t trimmed = 0;
+    MemoryPool *pl = pool();
+    if (pl)
+    {
+      t_busy = true;
+      trimmed = pl->trim();
+      t_busy = false;
+    }
+    auto na = next();
+    int released = (na && na->m_trim) ? na->m_trim(pad) : 0;
+    return (trimmed || released) ? 1 : 0;
+  }
+}
@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "PoolAllocator.hpp"
+#include "pool_alloc.h"
+#include "check.h"
+
+static size_t blksz[5] = {48, 64, 96, 128, 4096};
+
+struct alignas(64) SimdLane
+{
+  float m_lane[16];
+};
+
+bool aligned(void *p, size_t align)
+{
+  return p && (0 == (reinterpret_cast<uintptr_t>(p) % align));
+}
+
+int main()
+{
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = 5;
+  MemoryPool pool(config);
+  check(pool.isInitialized(), "pool initialized");
+
+  // 48 byte blocks are only 16 aligned, so the 64 byte class serves
+  void *a = pool.allocate(40, 64);
+  check(aligned(a, 64) && pool.owns(a) &&
+            (1 == pool.getStats().classes[1].allocations),
+      "64 byte alignment from the 64 byte class");
+
+  // 96 byte blocks are 32 aligned
+  void *b = pool.allocate(70, 32);
+  check(aligned(b, 32) && (1 == pool.getStats().classes[2].allocations),
+      "32 byte alignment from the 96 byte class");
+
+  void *c = pool.allocate(100, 4096);
+  check(aligned(c, 4096) && pool.owns(c), "page alignment from the 4096 class");
+
+  void *d = pool.allocate(1, 16);
+  check(aligned(d, 16) && pool.owns(d), "small alignment from the pool");
+
+  check(!pool.allocate(8, 8192) && !pool.allocate(8, 24),
+      "unsupported alignments refused");
+
+  pool.release(a);
+  pool.release(b);
+  pool.release(c);
+  pool.release(d);
+  check(0 == pool.getStats().classes[1].inUse, "aligned blocks released");
+
+  // The malloc overflow serves alignments no block size has
+  {
+    PoolConfig mallocConfig = config;
+    mallocConfig.overflow = PoolConfig::OVERFLOW_MALLOC;
+    MemoryPool overflow(mallocConfig);
+    void *p = overflow.allocate(8, 8192);
+    check(aligned(p, 8192) && overflow.isOverflow(p),
+        "large alignment served by malloc");
+    overflow.release(p);
+    check(!overflow.isOverflow(p), "aligned malloc block released");
+  }
+
+  // Containers of over-aligned types draw from the pool
+  {
+    std::vector<SimdLane, PoolAllocator<SimdLane>> lanes{
+        PoolAllocator<SimdLane>(pool)};
+    lanes.resize(2);
+    check(pool.owns(lanes.data()) && aligned(lanes.data(), 64),
+        "over-aligned container served by the pool");
+  }
+
+  // C API
+  pool_t *cpool = pool_create(blksz, 5);
+  void *e = pool_aligned_alloc_from(cpool, 64, 10);
+  check(aligned(e, 64), "pool_aligned_alloc_from");
+  pool_free_to(cpool, e);
+  pool_destroy(cpool);
+
+  check((alignof(BlockAllocator) == 64) && (sizeof(BlockAllocator) % 64 == 0),
+      "allocators padded to a cache line");
+
+  return !s_pass;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include "pool_alloc.h"
+#include "check.h"
+
+#define N_BLOCKS 768
+
+static size_t blksz[2] = {64, 128}; /* 512, 256 blocks of each */
+static void *blocks[N_BLOCKS + 1];
+static bool distinct(size_t n)
+{
+  /* Blocks are handed out exactly once, so duplicates mean a broken chain */
+  for (size_t i = 0; i < n; i++)
+  {
+    for (size_t j = i + 1; j < n; j++)
+    {
+      if (!blocks[i] || (blocks[i] == blocks[j]))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  check(pool_init(blksz, 2), "pool initialized");
+
+  /* Bursts fall through to the larger block size once the smaller runs out */
+  check(pool_malloc_bulk(64, 300, blocks) == 300, "first burst allocated");
+  check(pool_malloc_bulk(64, 300, blocks + 300) == 300,
+      "second burst spans both block sizes");
+  check(pool_malloc_bulk(64, 300, blocks + 600) == 168,
+      "third burst cut short by exhaustion");
+  check(distinct(N_BLOCKS), "every block handed out once");
+  check(pool_malloc(8) == NULL, "pool exhausted");
+
+  /* A burst of frees returns every block, and repeating it changes nothing */
+  pool_free_bulk(blocks, N_BLOCKS);
+  pool_free_bulk(blocks, N_BLOCKS);
+  check(pool_malloc_bulk(128, 256, blocks) == 256 &&
+            pool_malloc_bulk(64, N_BLOCKS, blocks + 256) == 512 &&
+            pool_malloc(8) == NULL,
+      "all blocks released exactly once");
+
+  return !s_pass;
+}
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "pool_alloc.h"
+#include "check.h"
+
+#define N_BLOCKS 64
+
+static size_t blksz[2] = {64, 256};
+static void *blocks[N_BLOCKS];
+/* Caller-owned heap, dirtied before the pool is built on it */
+static _Alignas(4096) uint8_t s_heap[65536];
+
+static bool zeroed(const void *p, size_t n)
+{
+  const uint8_t *b = p;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (b[i])
+    {
+      return false;
+    }
+  }
+  return p != NULL;
+}
+
+int main()
+{
+  check(pool_init(blksz, 2), "pool initialized");
+
+  /* Fresh blocks come back zeroed, with their free list link cleared */
+  bool ok = true;
+  for (size_t i = 0; i < N_BLOCKS; i++)
+  {
+    blocks[i] = pool_calloc(4, 16);
+    ok = ok && zeroed(blocks[i], 64);
+    memset(blocks[i], 0xA5, 64);
+  }
+  check(ok, "fresh blocks zeroed");
+
+  /* Released blocks are reused dirty, and cleared again */
+  for (size_t i = 0; i < N_BLOCKS; i += 2)
+  {
+    pool_free(blocks[i]);
+  }
+  ok = true;
+  for (size_t i = 0; i < N_BLOCKS; i += 2)
+  {
+    blocks[i] = pool_calloc(1, 64);
+    ok = ok && zeroed(blocks[i], 64);
+  }
+  check(ok, "reused blocks zeroed");
+
+  /* Released blocks stacked on fresh ones in the thread cache */
+  void *fresh = pool_calloc(2, 100);
+  memset(fresh, 0xA5, 200);
+  pool_free(fresh);
+  void *again = pool_calloc(1, 200);
+  check((again == fresh) && zeroed(again, 200), "recycled cached block zeroed");
+  ok = true;
+  for (size_t i = 0; i < 8; i++)
+  {
+    ok = ok && zeroed(pool_calloc(1, 256), 256);
+  }
+  check(ok, "fresh blocks below it zeroed");
+
+  check(!pool_calloc(SIZE_MAX / 2, 4), "size overflow rejected");
+  check(!pool_calloc(1, 4096), "oversize request rejected");
+
+  /* Caller memory is not known to be zero, so every block is cleared */
+  memset(s_heap, 0xA5, sizeof(s_heap));
+  pool_config_t config = {0};
+  config.block_sizes = blksz;
+  config.block_size_count = 2;
+  config.heap_bytes = sizeof(s_heap);
+  config.heap_memory = s_heap;
+  pool_t *pool = pool_create_config(&config);
+  check(pool != NULL, "pool on caller memory created");
+  ok = true;
+  size_t count = 0;
+  void *p = NULL;
+  while ((p = pool_calloc_from(pool, 1, 256)))
+  {
+    ok = ok && zeroed(p, 256);
+    count++;
+  }
+  check(ok && (count > 0), "caller memory blocks zeroed");
+  pool_destroy(pool);
+
+  return !s_pass;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/** @brief Set until any check of the test fails */
+static bool s_pass = true;
+
+/**
+ * @brief Report the outcome of a check as a PASS or FAIL line
+ *
+ * @param ok Outcome of the check
+ * @param what Description of what was checked
+ */
+static void check(bool ok, const char *what)
+{
+  printf(" -- %s: %s\n", ok ? "PASS" : "FAIL", what);
+  fflush(stdout);
+  s_pass = s_pass && ok;
+}
@@ -0,0 +1,85 @@
+#include <iostream>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+size_t drain(MemoryPool &pool, const size_t n)
+{
+  size_t count = 0;
+  while (pool.allocate(n))
+  {
+    ++count;
+  }
+  return count;
+}
+
+int main()
+{
+  // Three sizes (no longer a power of 2); the 1024 byte class has no count
+  // and gets what the others leave of the default 64 KiB heap
+  {
+    size_t sizes[3] = {16384, 64, 1024};
+    size_t counts[3] = {1, 512, 0};
+    PoolConfig config;
+    config.blockSizes = sizes;
+    config.nSizes = 3;
+    config.blockCounts = counts;
+    MemoryPool pool(config);
+    check(pool.isInitialized(), "pool with block counts initialized");
+
+    // Release every class once so routing by slice is exercised
+    for (size_t n : {64, 1024, 16384})
+    {
+      pool.release(pool.allocate(n));
+    }
+    check((1 == drain(pool, 16384)) && (16 == drain(pool, 1024)) &&
+              (512 == drain(pool, 64)),
+        "block counts honored");
+  }
+
+  // Byte budgets for every class size the heap to their sum
+  {
+    size_t sizes[2] = {32, 256};
+    size_t budgets[2] = {4096 + 16, 2048};
+    PoolConfig config;
+    config.blockSizes = sizes;
+    config.nSizes = 2;
+    config.byteBudgets = budgets;
+    MemoryPool pool(config);
+    check(pool.isInitialized() && (6144 == pool.getHeapSize()),
+        "heap sized from byte budgets");
+    check((8 == drain(pool, 256)) && (128 == drain(pool, 32)),
+        "byte budgets honored");
+  }
+
+  // Budgets and shares that are not a whole number of non power of 2 blocks
+  // still give every whole block that fits
+  {
+    size_t sizes[2] = {80, 96};
+    size_t budgets[2] = {1000, 0};
+    PoolConfig config;
+    config.blockSizes = sizes;
+    config.nSizes = 2;
+    config.byteBudgets = budgets;
+    config.heapBytes = 2000;
+    config.overflow = PoolConfig::OVERFLOW_FAIL;
+    MemoryPool pool(config);
+    check(pool.isInitialized() && (1920 == pool.getHeapSize()),
+        "slices rounded down to whole blocks");
+    check((12 == drain(pool, 80)) && (10 == drain(pool, 96)),
+        "uneven budget and share honored");
+  }
+
+  // Budgets larger than the heap are rejected
+  {
+    size_t sizes[2] = {64, 128};
+    size_t counts[2] = {2048, 0};
+    PoolConfig config;
+    config.blockSizes = sizes;
+    config.nSizes = 2;
+    config.blockCounts = counts;
+    MemoryPool pool(config);
+    check(!pool.isInitialized(), "oversized budget rejected");
+  }
+
+  return !s_pass;
+}
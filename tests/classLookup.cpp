@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+static size_t blksz[8] = {1024, 16, 256, 32, 2048, 512, 64, 128};
+static constexpr size_t N_SIZES = sizeof(blksz) / sizeof(size_t);
+
+// Smallest block size holding n bytes
+size_t fitting(size_t n)
+{
+  size_t size = 16;
+  while (size < n)
+  {
+    size <<= 1;
+  }
+  return size;
+}
+
+int main()
+{
+  auto &pool = MemoryPool::getPool(blksz, N_SIZES);
+  pool.setCacheDepth(0);
+
+  // Drain the sizes from the largest down, so each only gets blocks of its
+  // own class, noting which blocks belong to which size
+  std::vector<void *> blocks[N_SIZES];
+  for (size_t k = N_SIZES; k-- > 0;)
+  {
+    void *p = nullptr;
+    while ((p = pool.allocate(size_t(16) << k)))
+    {
+      blocks[k].push_back(p);
+    }
+  }
+  for (auto &b : blocks)
+  {
+    for (auto p : b)
+    {
+      pool.release(p);
+    }
+  }
+  auto sizeOf = [&blocks](void *p) {
+    for (size_t k = 0; k < N_SIZES; ++k)
+    {
+      if (std::find(blocks[k].begin(), blocks[k].end(), p) != blocks[k].end())
+      {
+        return size_t(16) << k;
+      }
+    }
+    return size_t(0);
+  };
+
+  // Every request size goes straight to the smallest block holding it
+  bool ok = true;
+  for (size_t n = 0; n <= 2048; ++n)
+  {
+    void *p = pool.allocate(n);
+    ok = ok && p && (fitting(n) == sizeOf(p));
+    pool.release(p);
+  }
+  check(ok,
+      "every size served by the smallest fitting block");
+
+  check(!pool.allocate(2049) && !pool.allocate(size_t(1) << 40) &&
+      !pool.allocate(~size_t(0)),
+      "sizes above the largest block rejected");
+
+  // An empty class falls through to the next larger ones, in order
+  std::vector<void *> held;
+  std::vector<size_t> served;
+  std::vector<size_t> expected;
+  void *p = nullptr;
+  while ((p = pool.allocate(40)))
+  {
+    held.push_back(p);
+    served.push_back(sizeOf(p));
+  }
+  for (size_t k = 2; k < N_SIZES; ++k)
+  {
+    expected.insert(expected.end(), blocks[k].size(), size_t(16) << k);
+  }
+  check(served == expected,
+      "exhausted class falls through to larger ones");
+
+  // Released blocks are found by the lookup again
+  pool.release(held[0]);
+  check(pool.allocate(40) == held[0],
+      "class refilled by release");
+
+  return !s_pass;
+}
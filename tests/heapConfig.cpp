@@ -0,0 +1,45 @@
+#include <iostream>
+#include "MemoryPool.hpp"
+
+static size_t blksz[4] = {64, 256, 1024, 4096};
+
+int main()
+{
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = sizeof(blksz) / sizeof(size_t);
+#ifdef POOL_STATIC_HEAP
+  config.heapBytes = 32768;
+#else
+  config.heapBytes = 4 * 1024 * 1024;
+  config.heapFlags = PoolHeap::HEAP_THP;
+#endif
+  auto &pool = MemoryPool::getPool(config);
+
+  bool pass = pool.isInitialized() && (pool.getHeapSize() == config.heapBytes);
+  if (!pass)
+  {
+    std::cout << " -- FAIL: pool of " << config.heapBytes
+              << " bytes not initialized!" << std::endl;
+    return 1;
+  }
+
+  // Each size class gets a quarter of the heap
+  size_t count = 0;
+  while (pool.allocate(4096))
+  {
+    ++count;
+  }
+  if (count != config.heapBytes / 4 / 4096)
+  {
+    std::cout << " -- FAIL: " << count << " blocks of size 4096 available, "
+              << "expected " << config.heapBytes / 4 / 4096 << std::endl;
+    pass = false;
+  }
+  else
+  {
+    std::cout << " -- PASS: heap sized at runtime" << std::endl;
+  }
+
+  return !pass;
+}
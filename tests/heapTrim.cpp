@@ -0,0 +1,308 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+static constexpr size_t BLOCK_SIZE = 64;
+static constexpr size_t N_BLOCKS = 16384;
+static constexpr size_t SLICE_BYTES = BLOCK_SIZE * N_BLOCKS;
+static constexpr size_t N_THREADS = 4;
+static constexpr size_t N_ROUNDS = 20000;
+
+// Count the resident pages of a page aligned range
+size_t resident(void *p, size_t bytes)
+{
+  std::vector<unsigned char> vec(bytes / sysconf(_SC_PAGESIZE));
+  if (mincore(p, bytes, vec.data()))
+  {
+    return vec.size();
+  }
+  size_t n = 0;
+  for (auto v : vec)
+  {
+    n += v & 1;
+  }
+  return n;
+}
+
+PoolConfig trimConfig(unsigned trim,
+    unsigned interval,
+    size_t blockSize = BLOCK_SIZE)
+{
+  static size_t sizes[1];
+  static size_t counts[1] = {N_BLOCKS};
+  sizes[0] = blockSize;
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 1;
+  config.blockCounts = counts;
+  config.trim = trim;
+  config.trimInterval = interval;
+  return config;
+}
+
+// Allocate every block of the pool, touching each one
+std::vector<void *> fill(MemoryPool &pool)
+{
+  std::vector<void *> blocks;
+  void *p = nullptr;
+  while ((p = pool.allocate(BLOCK_SIZE)))
+  {
+    memset(p, 0x5A, BLOCK_SIZE);
+    blocks.push_back(p);
+  }
+  std::sort(blocks.begin(), blocks.end());
+  return blocks;
+}
+
+// Count the bytes of a block no longer holding the id written to them
+size_t damaged(const uint8_t *p, size_t n, size_t id)
+{
+  size_t bad = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    bad += (p[i] != static_cast<uint8_t>(id));
+  }
+  return bad;
+}
+
+void worker(MemoryPool *pool,
+    size_t id,
+    size_t blockSize,
+    std::atomic<size_t> *errors,
+    std::atomic<size_t> *running)
+{
+  std::vector<uint8_t *> held;
+  for (size_t r = 0; r < N_ROUNDS; ++r)
+  {
+    // Grow and shrink the working set so whole pages keep emptying
+    if ((r / 1000) % 2)
+    {
+      for (size_t i = 0; (i < 4) && !held.empty(); ++i)
+      {
+        uint8_t *p = held.back();
+        held.pop_back();
+        *errors += damaged(p, blockSize, id);
+        pool->release(p);
+      }
+    }
+    else if (auto p = static_cast<uint8_t *>(pool->allocate(blockSize)))
+    {
+      memset(p, static_cast<int>(id), blockSize);
+      held.push_back(p);
+    }
+  }
+  for (auto p : held)
+  {
+    *errors += damaged(p, blockSize, id);
+    pool->release(p);
+  }
+  --*running;
+}
+
+// Trim continuously while threads allocate, returning the bytes damaged
+size_t trimUnderLoad(MemoryPool &pool, size_t blockSize)
+{
+  std::atomic<size_t> errors{0};
+  std::atomic<size_t> running{N_THREADS};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < N_THREADS; ++t)
+  {
+    threads.emplace_back(
+        worker, &pool, t + 1, blockSize, &errors, &running);
+  }
+  size_t passes = 0;
+  while (running)
+  {
+    pool.trim();
+    ++passes;
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  std::cout << "    " << passes << " trims during the run" << std::endl;
+  return errors;
+}
+
+int main()
+{
+  const size_t pages = SLICE_BYTES / sysconf(_SC_PAGESIZE);
+
+  {
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_DONTNEED, 0));
+    std::vector<void *> blocks = fill(pool);
+    check(N_BLOCKS == blocks.size(), "every block allocated");
+    void *heap = blocks.front();
+    check(pages == resident(heap, SLICE_BYTES), "touched heap resident");
+
+    // One live block per page keeps every page
+    for (size_t i = 1; i < N_BLOCKS; i += 2)
+    {
+      pool.release(blocks[i]);
+    }
+    check((0 == pool.trim()) && (pages == resident(heap, SLICE_BYTES)),
+        "pages with live blocks kept");
+
+    for (size_t i = 0; i < N_BLOCKS; i += 2)
+    {
+      pool.release(blocks[i]);
+    }
+    size_t trimmed = pool.trim();
+    std::cout << "    " << trimmed << " bytes trimmed, "
+              << resident(heap, SLICE_BYTES) << " of " << pages
+              << " pages resident" << std::endl;
+    check((SLICE_BYTES == trimmed) && (0 == resident(heap, SLICE_BYTES)),
+        "free pages returned to the OS");
+    check(SLICE_BYTES == pool.getStats().classes[0].trimmedBytes,
+        "trimmed bytes reported");
+
+    // Trimmed pages come back one at a time, as their blocks are handed out
+    void *p = pool.allocate(BLOCK_SIZE);
+    memset(p, 0x5A, BLOCK_SIZE);
+    check(resident(heap, SLICE_BYTES) <= 1, "trimmed pages reused lazily");
+    pool.release(p);
+
+    std::vector<void *> again = fill(pool);
+    check(again == blocks, "every trimmed block reused");
+    check(pages == resident(heap, SLICE_BYTES), "reused pages resident");
+    check(0 == pool.getStats().classes[0].trimmedBytes,
+        "reused bytes no longer reported");
+  }
+
+  // Memory the caller supplied is not the pool's to give back
+  {
+    static std::vector<uint8_t> memory(2 * SLICE_BYTES);
+    PoolConfig config = trimConfig(PoolConfig::TRIM_DONTNEED, 0);
+    config.heapMemory = memory.data();
+    config.heapBytes = memory.size();
+    MemoryPool pool(config);
+    std::vector<void *> blocks = fill(pool);
+    pool.releaseBulk(blocks.data(), blocks.size());
+    bool kept = true;
+    for (auto p : blocks)
+    {
+      // Released blocks keep everything past their free list link
+      auto b = static_cast<uint8_t *>(p);
+      kept = kept && (0x5A == b[sizeof(void *)]) && (0x5A == b[BLOCK_SIZE - 1]);
+    }
+    check((0 == pool.trim()) && kept, "caller memory never trimmed");
+  }
+
+  // Lazy freeing leaves the pages to the kernel
+  {
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_FREE, 0));
+    std::vector<void *> blocks = fill(pool);
+    pool.releaseBulk(blocks.data(), blocks.size());
+    check(SLICE_BYTES == pool.trim(), "MADV_FREE trim");
+    check(N_BLOCKS == fill(pool).size(), "MADV_FREE pages reused");
+  }
+
+  // The background thread trims once memory is freed
+  {
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_DONTNEED, 10));
+    std::vector<void *> blocks = fill(pool);
+    void *heap = blocks.front();
+    std::thread releaser([&]() {
+      pool.releaseBulk(blocks.data(), blocks.size());
+    });
+    releaser.join();
+    size_t left = pages;
+    for (int i = 0; (i < 200) && left; ++i)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      left = resident(heap, SLICE_BYTES);
+    }
+    check(0 == left, "background thread trimmed the heap");
+  }
+
+  // Trimming while other threads allocate never hands out a block twice or
+  // loses a live block's contents
+  {
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_DONTNEED, 0));
+    pool.setCacheDepth(4);
+    size_t errors = trimUnderLoad(pool, BLOCK_SIZE);
+    check((0 == errors) && (N_BLOCKS == fill(pool).size()),
+        "concurrent trim keeps blocks intact");
+  }
+
+  // Blocks reaching across a page boundary into a trimmed page are only
+  // handed out again once the page has been advised away
+  {
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_DONTNEED, 0, 96));
+    pool.setCacheDepth(4);
+    check(0 == trimUnderLoad(pool, 96),
+        "concurrent trim keeps straddling blocks intact");
+  }
+
+  // A fragmented heap gives back every free page, however many runs it takes,
+  // and pages still trimmed are not advised again
+  {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    MemoryPool pool(trimConfig(PoolConfig::TRIM_DONTNEED, 0, page));
+    pool.setCacheDepth(0);
+    std::vector<void *> blocks = fill(pool);
+    size_t free = 0;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+      if (i % 16)
+      {
+        pool.release(blocks[i]);
+        free += page;
+      }
+    }
+    size_t trimmed = pool.trim();
+    std::cout << "    " << trimmed << " of " << free
+              << " free bytes trimmed" << std::endl;
+    check((free == trimmed) && (0 == pool.trim()) &&
+              (free == pool.getStats().classes[0].trimmedBytes),
+        "fragmented heap trimmed");
+  }
+
+  // Allocations keep being served while another thread trims
+  {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    PoolConfig config = trimConfig(PoolConfig::TRIM_DONTNEED, 0, page);
+    config.overflow = PoolConfig::OVERFLOW_FAIL;
+    MemoryPool pool(config);
+    pool.setCacheDepth(0);
+    std::atomic<bool> done{false};
+    std::thread trimmer([&]() {
+      while (!done)
+      {
+        pool.trim();
+      }
+    });
+    std::vector<void *> held;
+    size_t failed = 0;
+    for (size_t r = 0; r < 200000; ++r)
+    {
+      if (held.size() == 100)
+      {
+        pool.release(held.front());
+        held.erase(held.begin());
+      }
+      void *p = pool.allocate(page);
+      failed += !p;
+      if (p)
+      {
+        memset(p, 0x5A, BLOCK_SIZE);
+        held.push_back(p);
+      }
+    }
+    done = true;
+    trimmer.join();
+    std::cout << "    " << failed << " allocations failed" << std::endl;
+    check(0 == failed, "allocations served during trim");
+  }
+
+  return !s_pass;
+}
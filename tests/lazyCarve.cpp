@@ -0,0 +1,107 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "BlockAllocator.hpp"
+#include "MemoryPool.hpp"
+#include "check.h"
+#ifndef POOL_STATIC_HEAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static constexpr size_t BLOCK_SIZE = 64;
+static constexpr size_t N_BLOCKS = 1024;
+static constexpr uint8_t FILL = 0xA5;
+
+alignas(BLOCK_SIZE) static uint8_t s_heap[BLOCK_SIZE * N_BLOCKS];
+static std::atomic<uint64_t>
+    s_state[BlockAllocator::stateWords(N_BLOCKS, BLOCK_SIZE)];
+
+// Count the bytes of the heap from offset on that still hold the fill pattern
+size_t untouched(size_t offset)
+{
+  size_t n = 0;
+  for (size_t i = offset; i < sizeof(s_heap); ++i)
+  {
+    n += (FILL == s_heap[i]) ? 1 : 0;
+  }
+  return n;
+}
+
+#ifndef POOL_STATIC_HEAP
+// Count the resident pages of a page aligned range
+size_t resident(void *p, size_t bytes)
+{
+  std::vector<unsigned char> vec(bytes / sysconf(_SC_PAGESIZE));
+  if (mincore(p, bytes, vec.data()))
+  {
+    return bytes;
+  }
+  size_t n = 0;
+  for (auto v : vec)
+  {
+    n += v & 1;
+  }
+  return n;
+}
+#endif
+
+int main()
+{
+  // Constructing an allocator writes nothing to its space
+  memset(s_heap, FILL, sizeof(s_heap));
+  BlockAllocator allocator(BLOCK_SIZE, sizeof(s_heap),
+      reinterpret_cast<MemoryBlock *>(s_heap), s_state);
+  check(sizeof(s_heap) == untouched(0), "construction leaves space untouched");
+
+  // Blocks are carved in address order, touching nothing past them
+  size_t count = 0;
+  auto chain = allocator.allocateChain(4, count);
+  check((4 == count) && (reinterpret_cast<uint8_t *>(chain) == s_heap) &&
+            (sizeof(s_heap) - 4 * BLOCK_SIZE == untouched(4 * BLOCK_SIZE)),
+      "chain carved from the front of the space");
+
+  // Released blocks are reused before anything new is carved
+  auto block = allocator.allocateBlock();
+  allocator.releaseBlock(block);
+  check((allocator.allocateBlock() == block) &&
+            (sizeof(s_heap) - 5 * BLOCK_SIZE == untouched(5 * BLOCK_SIZE)),
+      "released block reused first");
+
+  // Every block is still available exactly once
+  size_t n = 5;
+  while (allocator.allocateBlock())
+  {
+    ++n;
+  }
+  check(N_BLOCKS == n, "whole space carved");
+
+#ifndef POOL_STATIC_HEAP
+  // A large mapped pool is created without faulting in its heap
+  static size_t blksz[2] = {64, 4096};
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = 2;
+  config.heapBytes = size_t(1) << 30;
+  auto start = std::chrono::steady_clock::now();
+  MemoryPool pool(config);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  check(pool.isInitialized(), "1 GiB pool initialized");
+  std::cout << " ** 1 GiB pool created in " << elapsed.count() << " us"
+            << std::endl;
+
+  // The 64 byte slice follows the 4096 byte one; past the first few blocks
+  // handed out, the rest of it stays unmapped
+  void *p = pool.allocate(64);
+  size_t page = sysconf(_SC_PAGESIZE);
+  auto base = reinterpret_cast<uint8_t *>(
+      reinterpret_cast<uintptr_t>(p) & ~(page - 1));
+  check(resident(base + 16 * page, 4096 * page) == 0,
+      "untouched blocks not resident");
+  pool.release(p);
+#endif
+
+  return !s_pass;
+}
@@ -0,0 +1,146 @@
+#include <atomic>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+#include "BlockAllocator.hpp"
+
+static constexpr size_t BLOCK_SIZE = 64;
+static constexpr size_t N_BLOCKS = 256;
+static constexpr size_t N_THREADS = 8;
+static constexpr size_t N_ROUNDS = 20000;
+
+alignas(BLOCK_SIZE) static uint8_t s_heap[BLOCK_SIZE * N_BLOCKS];
+
+// One ownership flag per block; a block handed out twice trips the exchange
+static std::atomic<uint8_t> s_owned[N_BLOCKS];
+static std::atomic<size_t> s_errors{0};
+static std::atomic<uint64_t>
+    s_state[BlockAllocator::stateWords(N_BLOCKS, BLOCK_SIZE)];
+
+size_t indexOf(void *p)
+{
+  return (reinterpret_cast<uint8_t *>(p) - s_heap) / BLOCK_SIZE;
+}
+
+void claim(MemoryBlock *block, size_t id)
+{
+  uint8_t expected = 0;
+  if (!s_owned[indexOf(block)].compare_exchange_strong(expected, 1))
+  {
+    std::cout << " -- FAIL: block @ " << block << " handed out twice!"
+              << std::endl;
+    ++s_errors;
+  }
+  *reinterpret_cast<size_t *>(block + 1) = id;
+}
+
+void unclaim(MemoryBlock *block, size_t id)
+{
+  if (*reinterpret_cast<size_t *>(block + 1) != id)
+  {
+    std::cout << " -- FAIL: block @ " << block << " modified by another thread!"
+              << std::endl;
+    ++s_errors;
+  }
+  s_owned[indexOf(block)] = 0;
+}
+
+void worker(BlockAllocator *allocator, size_t id)
+{
+  std::vector<MemoryBlock *> b;
+
+  for (size_t r = 0; r < N_ROUNDS; ++r)
+  {
+    // Alternate between single blocks and whole chains
+    if (r % 2)
+    {
+      for (size_t i = 0; i < (r % 7) + 1; ++i)
+      {
+        auto block = allocator->allocateBlock();
+        if (block)
+        {
+          claim(block, id);
+          b.emplace_back(block);
+        }
+      }
+      for (auto block : b)
+      {
+        unclaim(block, id);
+        allocator->releaseBlock(block);
+      }
+    }
+    else
+    {
+      size_t count = 0;
+      auto chain = allocator->allocateChain((r % 13) + 1, count);
+      for (auto block = chain; block; block = block->m_next)
+      {
+        claim(block, id);
+        b.emplace_back(block);
+      }
+      if (b.size() != count)
+      {
+        std::cout << " -- FAIL: chain of " << b.size() << " blocks, expected "
+                  << count << std::endl;
+        ++s_errors;
+      }
+      for (auto block : b)
+      {
+        unclaim(block, id);
+      }
+      if (chain)
+      {
+        for (size_t i = 0; i + 1 < b.size(); ++i)
+        {
+          b[i]->m_next = b[i + 1];
+        }
+        allocator->releaseChain(b.front(), b.back(), b.size());
+      }
+    }
+    b.clear();
+  }
+}
+
+int main()
+{
+  BlockAllocator allocator(BLOCK_SIZE, sizeof(s_heap),
+      reinterpret_cast<MemoryBlock *>(s_heap), s_state);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < N_THREADS; ++i)
+  {
+    threads.emplace_back(worker, &allocator, i + 1);
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+
+  // Every block must still be available exactly once
+  std::set<MemoryBlock *> seen;
+  MemoryBlock *block = nullptr;
+  while ((block = allocator.allocateBlock()))
+  {
+    if (!seen.insert(block).second)
+    {
+      std::cout << " -- FAIL: block @ " << block << " on free list twice!"
+                << std::endl;
+      ++s_errors;
+      break;
+    }
+  }
+
+  if (seen.size() != N_BLOCKS)
+  {
+    std::cout << " -- FAIL: " << seen.size() << " blocks recovered, expected "
+              << N_BLOCKS << std::endl;
+    ++s_errors;
+  }
+  else if (0 == s_errors)
+  {
+    std::cout << " -- PASS: no blocks lost or handed out twice" << std::endl;
+  }
+
+  return s_errors != 0;
+}
@@ -0,0 +1,96 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "pool_alloc.h"
+#include "check.h"
+
+#define N_POOLS 12
+
+static size_t net_sizes[2] = {256, 2048};
+static size_t parse_sizes[4] = {16, 32, 64, 128};
+static size_t drain(pool_t *pool, size_t n)
+{
+  size_t count = 0;
+  while (pool_malloc_from(pool, n))
+  {
+    count++;
+  }
+  return count;
+}
+
+static void *churn(void *arg)
+{
+  /* Leave blocks in this thread's cache, then exit after the pool is gone */
+  pool_t *pool = (pool_t *)arg;
+  for (int i = 0; i < 100; i++)
+  {
+    void *p = pool_malloc_from(pool, 16);
+    pool_free_to(pool, p);
+  }
+  return NULL;
+}
+
+int main()
+{
+  pool_t *net = pool_create(net_sizes, 2);
+  pool_t *parse = pool_create(parse_sizes, 4);
+  check(net && parse, "independent pools created");
+
+  /* Exhausting one pool leaves the other untouched */
+  void *b = pool_malloc_from(parse, 32);
+  check(drain(net, 2048) == 16 && drain(net, 256) == 128,
+      "network pool drained");
+  check(pool_malloc_from(net, 256) == NULL, "network pool exhausted");
+  check(pool_malloc_from(parse, 64) != NULL, "parse pool still available");
+
+  /* Memory from one pool is not accepted by another */
+  pool_free_to(net, b);
+  check(pool_malloc_from(net, 256) == NULL, "foreign block rejected");
+  pool_free_to(parse, b);
+
+  /* Pools carved from caller-owned memory */
+  static uint64_t buffer[8192 / sizeof(uint64_t)];
+  pool_config_t config = {0};
+  config.block_sizes = parse_sizes;
+  config.block_size_count = 4;
+  config.heap_bytes = sizeof(buffer);
+  config.heap_memory = buffer;
+  pool_t *local = pool_create_config(&config);
+  void *l = local ? pool_malloc_from(local, 100) : NULL;
+  check(l >= (void *)buffer && l < (void *)(buffer + 1024),
+      "pool backed by caller memory");
+
+  /* More pools than a thread caches at once */
+  pool_t *many[N_POOLS];
+  bool ok = true;
+  for (int i = 0; i < N_POOLS; i++)
+  {
+    many[i] = pool_create(parse_sizes, 4);
+    pool_free_to(many[i], pool_malloc_from(many[i], 128));
+  }
+  for (int i = 0; i < N_POOLS; i++)
+  {
+    ok = ok && (drain(many[i], 128) == 128);
+    pool_destroy(many[i]);
+  }
+  check(ok, "thread caches evicted across many pools");
+
+  /* A thread exiting after its pool was destroyed */
+  pthread_t t;
+  pool_t *transient = pool_create(parse_sizes, 4);
+  pthread_create(&t, NULL, churn, transient);
+  pthread_join(t, NULL);
+  pool_destroy(transient);
+  transient = pool_create(parse_sizes, 4);
+  pthread_create(&t, NULL, churn, transient);
+  pool_destroy(NULL);
+  pthread_join(t, NULL);
+  check(drain(transient, 16) == 1024 + 512 + 256 + 128,
+      "blocks returned on thread exit");
+  pool_destroy(transient);
+
+  pool_destroy(local);
+  pool_destroy(net);
+  pool_destroy(parse);
+  return !s_pass;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <thread>
+#include "NumaMemoryPool.hpp"
+#include "check.h"
+
+static size_t blksz[2] = {64, 256};  // 512, 128 blocks of each per node
+
+int main()
+{
+  check(NumaMemoryPool::threadNode() < NumaMemoryPool::detectNodes(),
+      "calling thread's node detected");
+
+  // Two nodes whatever the machine has, so routing is testable on one node
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = 2;
+  NumaMemoryPool pool(config, 2);
+  check(pool.isInitialized() && (2 == pool.getNodeCount()),
+      "pool per node initialized");
+
+  NumaMemoryPool::setThreadNode(0);
+  void *local = pool.allocate(64);
+  check(0 == pool.nodeOf(local), "allocation from the thread's node");
+
+  // Another node's thread frees the block back to its home node
+  void *remote = nullptr;
+  std::thread t(
+      [&]()
+      {
+        NumaMemoryPool::setThreadNode(1);
+        remote = pool.allocate(64);
+        pool.release(local);
+      });
+  t.join();
+  check(1 == pool.nodeOf(remote), "allocation from the other thread's node");
+
+  size_t count = 0;
+  while (pool.getNodePool(0).allocate(64))
+  {
+    ++count;
+  }
+  check(640 == count, "remote free returned to the home node");
+
+  // With the thread's node exhausted, allocations spill to the next node
+  void *spill = pool.allocate(64);
+  check(1 == pool.nodeOf(spill), "exhausted node spills over");
+  pool.release(spill, 64);
+  pool.release(remote);
+
+  NumaMemoryPool::setThreadNode(-1);
+  return !s_pass;
+}
@@ -0,0 +1,132 @@
+#include <iostream>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+// Caller-owned heap for the secondary pool, so both pools fit static builds
+alignas(4096) static uint8_t s_overflowHeap[16384];
+
+static size_t blksz[3] = {64, 256, 1024};
+static size_t blkcnt[3] = {4, 4, 1};
+
+size_t drain(MemoryPool &pool, const size_t n)
+{
+  size_t count = 0;
+  while (pool.allocate(n))
+  {
+    ++count;
+  }
+  return count;
+}
+
+PoolConfig smallConfig(unsigned overflow)
+{
+  PoolConfig config;
+  config.blockSizes = blksz;
+  config.nSizes = 3;
+  config.blockCounts = blkcnt;
+  config.overflow = overflow;
+  return config;
+}
+
+int main()
+{
+  // Default: small requests use up every larger block
+  {
+    MemoryPool pool(smallConfig(PoolConfig::OVERFLOW_BORROW));
+    check(9 == drain(pool, 64), "borrow takes every larger block");
+    PoolStats stats = pool.getStats();
+    check((5 == stats.classes[0].fallThroughs) &&
+              (1 == stats.classes[0].failures),
+        "borrowed blocks counted as fall-throughs");
+  }
+
+  // A borrow limit keeps the largest blocks for large requests
+  {
+    PoolConfig config = smallConfig(PoolConfig::OVERFLOW_BORROW);
+    config.borrowLimit = 1;
+    MemoryPool pool(config);
+    check(8 == drain(pool, 64), "borrow limited to the next block size");
+    check(nullptr != pool.allocate(1024), "largest block kept");
+  }
+
+  // Fail fast never borrows
+  {
+    MemoryPool pool(smallConfig(PoolConfig::OVERFLOW_FAIL));
+    check(4 == drain(pool, 64), "fail fast stops at the size class");
+    check(4 == drain(pool, 256), "larger size class untouched");
+    PoolStats stats = pool.getStats();
+    check((0 == stats.classes[0].fallThroughs) &&
+              (1 == stats.classes[0].failures),
+        "fail fast counted as a failure");
+  }
+
+  // A secondary pool absorbs exhausted classes and oversize requests
+  {
+    size_t sizes[2] = {64, 4096};
+    PoolConfig overflowConfig;
+    overflowConfig.blockSizes = sizes;
+    overflowConfig.nSizes = 2;
+    overflowConfig.heapBytes = sizeof(s_overflowHeap);
+    overflowConfig.heapMemory = s_overflowHeap;
+    MemoryPool overflow(overflowConfig);
+
+    PoolConfig config = smallConfig(PoolConfig::OVERFLOW_HEAP);
+    config.overflowHeap = &overflow;
+    MemoryPool pool(config);
+    check(pool.isInitialized(), "pool with overflow heap initialized");
+
+    size_t fromPool = 0;
+    void *p = nullptr;
+    while ((p = pool.allocate(64)) && pool.owns(p))
+    {
+      ++fromPool;
+    }
+    check((4 == fromPool) && overflow.owns(p) && pool.isOverflow(p),
+        "exhausted class served by the overflow heap");
+    pool.release(p);
+    check(1 == overflow.getStats().classes[0].frees,
+        "overflow block released to the overflow heap");
+
+    void *large = pool.allocate(2048);
+    check(overflow.owns(large), "oversize request served by overflow heap");
+    pool.release(large);
+
+    PoolStats stats = pool.getStats();
+    check((1 == stats.classes[0].overflows) && (1 == stats.oversize) &&
+              (2 == stats.overflows) && (2 == stats.overflowFrees) &&
+              (0 == stats.classes[0].fallThroughs),
+        "overflow heap counted");
+
+    MemoryPool noHeap(smallConfig(PoolConfig::OVERFLOW_HEAP));
+    check(!noHeap.isInitialized(), "overflow heap required");
+  }
+
+  // malloc absorbs everything, with release routed by tracked ownership
+  {
+    MemoryPool pool(smallConfig(PoolConfig::OVERFLOW_MALLOC));
+    void *b[6];
+    check(6 == pool.allocateBulk(64, 6, b), "bulk request spills into malloc");
+    check(pool.owns(b[3]) && !pool.owns(b[4]) && pool.isOverflow(b[4]) &&
+              pool.isOverflow(b[5]),
+        "malloc blocks tracked");
+
+    void *large = pool.allocate(100000);
+    check(large && pool.isOverflow(large), "oversize request served by malloc");
+    pool.release(large);
+    check(!pool.isOverflow(large), "malloc block freed by release");
+
+    int local = 0;
+    pool.release(&local);
+    pool.releaseBulk(b, 6);
+    PoolStats stats = pool.getStats();
+    check((2 == stats.classes[0].overflows) &&
+              (0 == stats.classes[0].failures) && (3 == stats.overflows) &&
+              (3 == stats.overflowFrees) && (4 == stats.classes[0].frees),
+        "malloc overflow counted, foreign pointer ignored");
+
+    // Blocks still allocated when the pool is destroyed are freed with it
+    pool.allocate(100000);
+  }
+
+  return !s_pass;
+}
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PoolAllocator.hpp"
+#include "PoolMemoryResource.hpp"
+#include "check.h"
+
+// Upstream resource counting what the pool passes on
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+  size_t m_live{0};
+  size_t m_total{0};
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override
+  {
+    ++m_live;
+    ++m_total;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override
+  {
+    --m_live;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override
+  {
+    return this == &other;
+  }
+};
+
+int main()
+{
+  size_t sizes[4] = {32, 64, 128, 256};
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 4;
+  MemoryPool pool(config);
+
+  {
+    CountingResource upstream;
+    PoolMemoryResource resource(pool, &upstream);
+
+    // List nodes come from the pool
+    std::pmr::list<int> list(&resource);
+    for (int i = 0; i < 100; ++i)
+    {
+      list.push_back(i);
+    }
+    bool fromPool = true;
+    for (auto &i : list)
+    {
+      fromPool = fromPool && pool.owns(&i);
+    }
+    check(fromPool && (0 == upstream.m_total), "pmr list nodes from pool");
+
+    // Storage larger than the largest block goes upstream
+    std::pmr::vector<int> vector(&resource);
+    vector.resize(1000);
+    check(!pool.owns(vector.data()) && (1 == upstream.m_live),
+        "large pmr vector storage from upstream");
+    vector = std::pmr::vector<int>(&resource);
+    check(0 == upstream.m_live, "upstream storage returned");
+
+    // Over-aligned requests use a naturally aligned block size, and go
+    // upstream when no block size has the alignment
+    void *p = resource.allocate(64, 64);
+    check(pool.owns(p) && (0 == reinterpret_cast<uintptr_t>(p) % 64) &&
+              (0 == upstream.m_live),
+        "over-aligned from pool");
+    resource.deallocate(p, 64, 64);
+    p = resource.allocate(64, 1024);
+    check(!pool.owns(p) && (1 == upstream.m_live), "over-aligned upstream");
+    resource.deallocate(p, 64, 1024);
+  }
+
+  {
+    PoolAllocator<int> alloc(pool);
+    std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>,
+        PoolAllocator<std::pair<const int, std::string>>>
+        map(16, std::hash<int>(), std::equal_to<int>(), alloc);
+    for (int i = 0; i < 50; ++i)
+    {
+      map.emplace(i, std::to_string(i));
+    }
+    bool fromPool = true;
+    for (auto &kv : map)
+    {
+      fromPool = fromPool && pool.owns(&kv);
+    }
+    check(fromPool && (map.at(42) == "42"), "unordered_map nodes from pool");
+
+    std::list<double, PoolAllocator<double>> list(alloc);
+    list.assign(10, 1.0);
+    check(pool.owns(&list.front()) && (alloc == list.get_allocator()),
+        "std::list nodes from pool");
+
+    std::vector<int, PoolAllocator<int>> vector(alloc);
+    vector.resize(1000);
+    check(!pool.owns(vector.data()), "large vector storage from operator new");
+
+    // A count whose size wraps around must not come back as a small block
+    bool threw = false;
+    try
+    {
+      PoolAllocator<uint64_t>(pool).allocate((SIZE_MAX / 8) + 2);
+    }
+    catch (const std::bad_array_new_length &)
+    {
+      threw = true;
+    }
+    check(threw, "overflowing count rejected");
+  }
+
+  // Every block went back: the smallest class is whole again
+  size_t count = 0;
+  pool.setCacheDepth(0);
+  while (pool.allocate(32))
+  {
+    ++count;
+  }
+  check(960 == count, "all blocks returned to pool");
+
+  return !s_pass;
+}
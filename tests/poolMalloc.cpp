@@ -0,0 +1,171 @@
+#include <malloc.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "check.h"
+
+static constexpr size_t N_THREADS = 4;
+static constexpr size_t N_ROUNDS = 2000;
+
+bool filled(const void *p, size_t n, unsigned char c)
+{
+  auto b = static_cast<const unsigned char *>(p);
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (b[i] != c)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Block sizes off malloc's alignment are rounded up to it, so small requests
+// still get 16 byte aligned blocks
+bool smallClasses()
+{
+  bool ok = true;
+  for (size_t n : {1, 8, 16, 24})
+  {
+    std::vector<void *> blocks(64);
+    for (auto &b : blocks)
+    {
+      b = malloc(n);
+      ok = ok && b && (0 == reinterpret_cast<uintptr_t>(b) % 16) &&
+           (((n + 15) & ~size_t(15)) == malloc_usable_size(b));
+    }
+    for (auto b : blocks)
+    {
+      free(b);
+    }
+  }
+  check(ok, "malloc aligned to 16 bytes with small classes");
+
+  void *p = aligned_alloc(16, 8);
+  void *q = memalign(32, 8);
+  check(p && (0 == reinterpret_cast<uintptr_t>(p) % 16) &&
+            (16 == malloc_usable_size(p)) && q &&
+            (0 == reinterpret_cast<uintptr_t>(q) % 32) &&
+            (32 == malloc_usable_size(q)),
+      "aligned_alloc and memalign served from pool");
+  free(p);
+  free(q);
+  return s_pass;
+}
+
+// Every thread frees the blocks allocated by the previous one
+void worker(std::vector<void *> *mine, std::vector<void *> *theirs)
+{
+  for (size_t r = 0; r < N_ROUNDS; ++r)
+  {
+    mine->push_back(malloc(16 + (r % 512)));
+  }
+  while (!theirs->empty())
+  {
+    free(theirs->back());
+    theirs->pop_back();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  // Rerun under the interposition library unless it is already loaded
+  if (!getenv("POOL_MALLOC_TEST"))
+  {
+    setenv("POOL_MALLOC_TEST", "1", 1);
+    setenv("LD_PRELOAD", POOLMALLOC_PATH, 1);
+    execv("/proc/self/exe", argv);
+    std::cout << " -- FAIL: could not rerun with LD_PRELOAD" << std::endl;
+    return 1;
+  }
+  if (0 == strcmp(getenv("POOL_MALLOC_TEST"), "small"))
+  {
+    return !smallClasses();
+  }
+
+  // Requests fitting a block size come from the pool, whose 48 byte block is
+  // larger than the 40 bytes malloc itself would report
+  void *p = malloc(40);
+  check(48 == malloc_usable_size(p), "malloc served from pool");
+  memset(p, 0xA5, 40);
+
+  void *q = realloc(p, 44);
+  check((q == p) && filled(q, 40, 0xA5), "realloc grows in place");
+  p = realloc(q, 2000);
+  check(p && (2048 == malloc_usable_size(p)) && filled(p, 40, 0xA5),
+      "realloc moves to a larger block");
+  q = realloc(p, 40);
+  check(q && (48 == malloc_usable_size(q)) && filled(q, 40, 0xA5),
+      "realloc shrinks to a smaller block");
+  p = realloc(q, 2000);
+  memset(p, 0x5A, 2000);
+  q = realloc(p, size_t(1) << 20);
+  check(q && (malloc_usable_size(q) >= (size_t(1) << 20)) &&
+            filled(q, 2000, 0x5A),
+      "realloc moves to the next allocator");
+  free(q);
+
+  void *large = malloc(size_t(1) << 20);
+  check(large && (malloc_usable_size(large) >= (size_t(1) << 20)),
+      "large request forwarded");
+  free(large);
+
+  // A dirty block handed out again by calloc is cleared
+  p = malloc(64);
+  memset(p, 0xFF, 64);
+  free(p);
+  q = calloc(8, 8);
+  check((q == p) && filled(q, 64, 0), "calloc reuses and clears block");
+  free(q);
+
+  void *a = nullptr;
+  check((0 == posix_memalign(&a, 64, 40)) &&
+            (0 == reinterpret_cast<uintptr_t>(a) % 64) &&
+            (64 == malloc_usable_size(a)),
+      "posix_memalign served from pool");
+  free(a);
+  check((0 == posix_memalign(&a, 8192, 40)) &&
+            (0 == reinterpret_cast<uintptr_t>(a) % 8192),
+      "posix_memalign forwarded");
+  free(a);
+  check(EINVAL == posix_memalign(&a, 24, 40), "bad alignment rejected");
+
+  std::vector<std::vector<void *>> blocks(N_THREADS);
+  for (size_t round = 0; round < 3; ++round)
+  {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < N_THREADS; ++i)
+    {
+      threads.emplace_back(worker, &blocks[i],
+          &blocks[(i + N_THREADS - 1) % N_THREADS]);
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+  }
+  for (auto &b : blocks)
+  {
+    for (auto block : b)
+    {
+      free(block);
+    }
+  }
+  check(true, "cross-thread malloc/free");
+
+  // Finish with a pool of small block sizes only
+  if (s_pass)
+  {
+    setenv("POOL_MALLOC_TEST", "small", 1);
+    setenv("POOL_MALLOC_SIZES", "8,16,24,32,64", 1);
+    execv("/proc/self/exe", argv);
+    std::cout << " -- FAIL: could not rerun with small block sizes"
+              << std::endl;
+    return 1;
+  }
+  return !s_pass;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include "pool_alloc.h"
+#include "check.h"
+
+static size_t sizes[2] = {64, 128};
+static size_t counts[2] = {2, 2};
+int main()
+{
+  pool_stats_t stats;
+  check(!pool_get_stats(&stats), "no statistics before initialization");
+
+  pool_config_t config = {0};
+  config.block_sizes = sizes;
+  config.block_size_count = 2;
+  config.block_counts = counts;
+  check(pool_init_config(&config), "pool initialized");
+
+  /* Four 64 byte requests: two fall through to 128, one fails */
+  void *b[5];
+  for (int i = 0; i < 5; i++)
+  {
+    b[i] = pool_malloc(64);
+  }
+  pool_malloc(4096);
+  for (int i = 0; i < 4; i++)
+  {
+    pool_free(b[i]);
+  }
+  pool_free(b[0]);
+
+  check(pool_get_stats(&stats) && (stats.class_count == 2), "snapshot taken");
+  pool_class_stats_t *small = &stats.classes[0];
+  pool_class_stats_t *large = &stats.classes[1];
+  check(small->block_size == 64 && small->block_count == 2 &&
+            large->block_size == 128 && large->block_count == 2,
+      "block sizes and counts");
+  check(small->allocations == 2 && small->frees == 2 && small->in_use == 0 &&
+            small->high_water == 2,
+      "allocations, frees and high-water mark");
+  check(small->fall_throughs == 2 && large->fall_throughs == 0,
+      "fall-throughs counted against the requested size");
+  check(small->failures == 1 && stats.oversize == 1, "failures counted");
+  check(large->allocations == 2 && large->high_water == 2, "larger size");
+
+  return !s_pass;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include "pool_alloc.h"
+#include "check.h"
+
+static size_t sizes[5] = {64, 80, 96, 128, 256};
+static size_t counts[5] = {4, 4, 4, 4, 1};
+static bool filled(const char *p, char c, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    if (p[i] != c)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  pool_config_t config = {0};
+  config.block_sizes = sizes;
+  config.block_size_count = 5;
+  config.block_counts = counts;
+  config.overflow_policy = POOL_OVERFLOW_FAIL;
+  pool_t *pool = pool_create_config(&config);
+  check(pool != NULL, "pool created");
+
+  char *p = pool_realloc_from(pool, NULL, 40);
+  check(p && (pool_usable_size_from(pool, p) == 64), "NULL is allocated");
+  memset(p, 'a', 64);
+  check(pool_realloc_from(pool, p, 64) == p, "growth into the slack in place");
+
+  char *q = pool_realloc_from(pool, p, 90);
+  check(q && (q != p) && (pool_usable_size_from(pool, q) == 96) &&
+            filled(q, 'a', 64),
+      "growth past the block moves the data");
+  memset(q, 'b', 96);
+  check(pool_realloc_from(pool, q, 40) == q,
+      "shrinking by less than half in place");
+
+  char *r = pool_realloc_from(pool, q, 200);
+  memset(r, 'c', 256);
+  char *s = pool_realloc_from(pool, r, 100);
+  check(s && (s != r) && (pool_usable_size_from(pool, s) == 128) &&
+            filled(s, 'c', 100),
+      "shrinking to half the block moves the data");
+
+  check(!pool_realloc_from(pool, s, 4096) && filled(s, 'c', 100),
+      "failed growth leaves the data");
+  check(!pool_realloc_from(pool, r, 64), "released block rejected");
+  check(!pool_realloc_from(pool, s, 0) && !pool_usable_size_from(pool, &r),
+      "zero size releases");
+
+  pool_stats_t stats;
+  pool_get_stats_from(pool, &stats);
+  uint64_t inUse = 0;
+  for (size_t i = 0; i < stats.class_count; i++)
+  {
+    inUse += stats.classes[i].in_use;
+  }
+  check(inUse == 0, "moved blocks released");
+  pool_destroy(pool);
+
+  /* Overflow allocations grow in place up to their usable size too */
+  config.overflow_policy = POOL_OVERFLOW_MALLOC;
+  check(pool_init_config(&config), "pool initialized");
+  char *big = pool_realloc(NULL, 1000);
+  check(big && (pool_usable_size(big) >= 1000), "oversize served by malloc");
+  memset(big, 'd', 1000);
+  check(pool_realloc(big, 900) == big, "overflow shrink in place");
+  char *bigger = pool_realloc(big, 100000);
+  check(bigger && filled(bigger, 'd', 1000), "overflow growth moves");
+  pool_free(bigger);
+
+  char *small = pool_malloc(64);
+  memset(small, 'e', 64);
+  char *moved = pool_realloc(small, 5000);
+  check(moved && filled(moved, 'e', 64) && (pool_usable_size(moved) >= 5000),
+      "block grown into malloc");
+  pool_free(moved);
+
+  return !s_pass;
+}
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+static size_t blksz[4] = {16, 64, 256, 1024};
+static constexpr size_t N_SIZES = sizeof(blksz) / sizeof(size_t);
+
+// Allocate every block, from the largest size down so each size only gets
+// blocks of its own class
+void drain(MemoryPool &pool, std::vector<uint8_t *> *blocks)
+{
+  for (size_t k = N_SIZES; k-- > 0;)
+  {
+    blocks[k].clear();
+    void *p = nullptr;
+    while ((p = pool.allocate(blksz[k])))
+    {
+      blocks[k].push_back(static_cast<uint8_t *>(p));
+    }
+    std::sort(blocks[k].begin(), blocks[k].end());
+  }
+}
+
+// Check that every block went back to the class owning it, and nothing else
+bool drainsTo(MemoryPool &pool, const std::vector<uint8_t *> *blocks)
+{
+  std::vector<uint8_t *> again[N_SIZES];
+  drain(pool, again);
+  return std::equal(blocks, blocks + N_SIZES, again);
+}
+
+int main()
+{
+  auto &pool = MemoryPool::getPool(blksz, N_SIZES);
+  pool.setCacheDepth(0);
+
+  std::vector<uint8_t *> blocks[N_SIZES];
+  drain(pool, blocks);
+  uint8_t *first = blocks[0].front();
+  uint8_t *last = blocks[0].back();
+  for (auto &b : blocks)
+  {
+    first = std::min(first, b.front());
+    last = std::max(last, b.back());
+  }
+
+  // Pointers outside the heap are rejected by the bounds compare alone
+  int local = 0;
+  pool.release(&local);
+  pool.release(first - 16);
+  pool.release(first - 1);
+  pool.release(last + (size_t(1) << 20));
+  pool.release(reinterpret_cast<void *>(~uintptr_t(0)));
+  for (auto &b : blocks)
+  {
+    for (auto p : b)
+    {
+      pool.release(p);
+    }
+  }
+  check(drainsTo(pool, blocks),
+      "blocks returned to their owners, pointers outside the heap rejected");
+
+  // Pointers into the heap off a block boundary are rejected by the owner
+  for (size_t k = 0; k < N_SIZES; ++k)
+  {
+    for (auto p : blocks[k])
+    {
+      pool.release(p + 1);
+      pool.release(p + 8);
+      pool.release(p + blksz[k] - 1);
+    }
+  }
+  for (auto &b : blocks)
+  {
+    for (auto p : b)
+    {
+      pool.release(p);
+    }
+  }
+  check(drainsTo(pool, blocks),
+      "pointers inside blocks rejected");
+
+  // A block released twice only goes back once
+  for (auto &b : blocks)
+  {
+    for (auto p : b)
+    {
+      pool.release(p);
+      pool.release(p);
+    }
+  }
+  check(drainsTo(pool, blocks),
+      "double releases ignored");
+
+  return !s_pass;
+}
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "BlockAllocator.hpp"
+#include "MemoryPool.hpp"
+#include "check.h"
+
+static constexpr size_t BLOCK_SIZE = 64;
+static constexpr size_t N_BLOCKS = 8;
+static constexpr size_t N_MESSAGES = 200000;
+
+alignas(BLOCK_SIZE) static uint8_t s_heap[BLOCK_SIZE * N_BLOCKS];
+static std::atomic<uint64_t>
+    s_state[BlockAllocator::stateWords(N_BLOCKS, BLOCK_SIZE)];
+
+/**
+ * @brief Hand-off between a producer and a consumer thread
+ */
+struct Mailbox
+{
+  std::mutex m_lock;
+  std::deque<size_t *> m_items;
+  std::atomic<bool> m_done{false};
+};
+
+void produce(MemoryPool &pool, Mailbox &mailbox, std::atomic<size_t> &misses)
+{
+  for (size_t i = 0; i < N_MESSAGES; ++i)
+  {
+    size_t *item = nullptr;
+    while (!(item = static_cast<size_t *>(pool.allocate(sizeof(size_t)))))
+    {
+      // Every block is in flight; wait for the consumer to free some
+      ++misses;
+      std::this_thread::yield();
+    }
+    *item = i;
+    std::lock_guard<std::mutex> guard(mailbox.m_lock);
+    mailbox.m_items.push_back(item);
+  }
+  mailbox.m_done = true;
+}
+
+size_t consume(MemoryPool &pool, Mailbox &mailbox)
+{
+  size_t expected = 0;
+  size_t errors = 0;
+  while (true)
+  {
+    size_t *item = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(mailbox.m_lock);
+      if (!mailbox.m_items.empty())
+      {
+        item = mailbox.m_items.front();
+        mailbox.m_items.pop_front();
+      }
+    }
+    if (!item)
+    {
+      if (mailbox.m_done && (expected == N_MESSAGES))
+      {
+        return errors;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    errors += (*item != expected++);
+    pool.release(item);
+  }
+}
+
+void pipeline(size_t depth, const char *what)
+{
+  size_t sizes[1] = {BLOCK_SIZE};
+  size_t counts[1] = {64};
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 1;
+  config.blockCounts = counts;
+  MemoryPool pool(config);
+  pool.setCacheDepth(depth);
+
+  Mailbox mailbox;
+  std::atomic<size_t> misses{0};
+  size_t errors = 0;
+  std::thread consumer([&]() { errors = consume(pool, mailbox); });
+  std::thread producer([&]() { produce(pool, mailbox, misses); });
+  producer.join();
+  consumer.join();
+
+  // Blocks the consumer's cache still holds go back when it exits, so the
+  // whole class can be allocated again
+  std::set<void *> blocks;
+  void *p = nullptr;
+  while ((p = pool.allocate(BLOCK_SIZE)))
+  {
+    blocks.insert(p);
+  }
+
+  PoolStats stats = pool.getStats();
+  std::cout << "    " << misses << " producer misses, "
+            << stats.classes[0].contention << " contention events"
+            << std::endl;
+  check((0 == errors) && (N_MESSAGES == stats.classes[0].frees) &&
+            (64 == blocks.size()),
+      what);
+}
+
+int main()
+{
+  // Blocks released by another thread are reclaimed on the next miss
+  {
+    BlockAllocator allocator(BLOCK_SIZE, sizeof(s_heap),
+        reinterpret_cast<MemoryBlock *>(s_heap), s_state);
+    std::set<MemoryBlock *> owned;
+    for (size_t i = 0; i < N_BLOCKS; ++i)
+    {
+      owned.insert(allocator.allocateBlock());
+    }
+    check(nullptr == allocator.allocateBlock(), "allocator exhausted");
+
+    std::thread remote([&]() {
+      for (auto block : owned)
+      {
+        allocator.releaseBlock(block);
+      }
+    });
+    remote.join();
+
+    std::set<MemoryBlock *> reclaimed;
+    MemoryBlock *block = nullptr;
+    while ((block = allocator.allocateBlock()))
+    {
+      reclaimed.insert(block);
+    }
+    check(owned == reclaimed, "remotely released blocks reclaimed");
+
+    // Blocks released one by one come back as a single chain
+    size_t count = 0;
+    auto chain = allocator.allocateChain(N_BLOCKS, count);
+    check((nullptr == chain) && (0 == count), "nothing left to reclaim");
+    for (auto b : reclaimed)
+    {
+      allocator.releaseBlock(b);
+    }
+    chain = allocator.allocateChain(N_BLOCKS, count);
+    check(N_BLOCKS == count, "remote list reclaimed as one chain");
+  }
+
+  // Producer allocates, consumer frees, with and without thread caches
+  pipeline(0, "uncached pipeline recycles every block");
+  pipeline(16, "cached pipeline recycles every block");
+
+  return !s_pass;
+}
@@ -0,0 +1,158 @@
+#include <execinfo.h>
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+static constexpr size_t BLOCK_SIZE = 64;
+static constexpr size_t N_BLOCKS = 512;
+static constexpr size_t RATE = 128;
+static constexpr size_t N_THREADS = 4;
+
+size_t liveSamples(MemoryPool &pool)
+{
+  std::ostringstream out;
+  return pool.dumpSamples(out, PoolSampler::FORMAT_TEXT);
+}
+
+size_t countLines(const std::string &text,
+    const std::string &what,
+    bool atEnd = false)
+{
+  size_t n = 0;
+  std::istringstream in(text);
+  std::string line;
+  while (std::getline(in, line))
+  {
+    size_t at = line.rfind(what);
+    n += (at != std::string::npos) &&
+         (!atEnd || (at + what.size() == line.size()));
+  }
+  return n;
+}
+
+__attribute__((noinline)) std::vector<void *> allocateSome(MemoryPool &pool)
+{
+  std::vector<void *> blocks;
+  for (size_t i = 0; i < N_BLOCKS; ++i)
+  {
+    blocks.push_back(pool.allocate(BLOCK_SIZE));
+  }
+  return blocks;
+}
+
+void worker(MemoryPool *pool)
+{
+  std::vector<void *> held;
+  for (size_t r = 0; r < 50000; ++r)
+  {
+    if ((r % 3) && !held.empty())
+    {
+      pool->release(held.back());
+      held.pop_back();
+    }
+    else if (void *p = pool->allocate(BLOCK_SIZE))
+    {
+      held.push_back(p);
+    }
+  }
+  pool->releaseBulk(held.data(), held.size());
+}
+
+int main()
+{
+  size_t sizes[2] = {BLOCK_SIZE, 256};
+  size_t counts[2] = {N_BLOCKS, 16};
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 2;
+  config.blockCounts = counts;
+  MemoryPool pool(config);
+
+  // Nothing is recorded until sampling is enabled
+  std::vector<void *> blocks = allocateSome(pool);
+  check((0 == pool.getSampleRate()) && (0 == liveSamples(pool)),
+      "sampling disabled by default");
+  pool.releaseBulk(blocks.data(), blocks.size());
+
+  // An allocation is sampled when a sampling point falls within its bytes,
+  // spaced RATE bytes apart on average
+  check(pool.setSampleRate(RATE) && (RATE == pool.getSampleRate()),
+      "sampling enabled");
+  blocks = allocateSome(pool);
+  std::ostringstream text;
+  size_t live = pool.dumpSamples(text, PoolSampler::FORMAT_TEXT);
+  size_t expected =
+      N_BLOCKS * (1.0 - std::exp(-1.0 * BLOCK_SIZE / RATE)) + 0.5;
+  std::cout << "    " << live << " samples, " << expected << " expected"
+            << std::endl;
+  check((live > expected / 2) && (live < expected * 2),
+      "sampled at about the rate");
+  check(live == countLines(text.str(), "64 bytes in 64 byte blocks @ 0x"),
+      "samples record their size class");
+
+  // Samples carry the stack all the way out through main()
+  void *frames[PoolSampler::DEPTH_MAX] = {};
+  int depth = backtrace(frames, PoolSampler::DEPTH_MAX);
+  std::ostringstream caller;
+  caller << " 0x" << std::hex << reinterpret_cast<uintptr_t>(frames[depth - 1]);
+  check(live == countLines(text.str(), caller.str(), true),
+      "samples record the call stack");
+
+  std::ostringstream profile;
+  check((live == pool.dumpSamples(profile, PoolSampler::FORMAT_PPROF)) &&
+            (0 == profile.str().find("heap profile: ")) &&
+            (1 == countLines(profile.str(), "@ heap_v2/128")) &&
+            (live == countLines(profile.str(), "1: 64 [1: 64] @ 0x")) &&
+            (1 == countLines(profile.str(), "MAPPED_LIBRARIES:")),
+      "heap profile written");
+
+  // Samples go when their blocks do, even with sampling disabled since
+  for (size_t i = 0; i < N_BLOCKS; i += 2)
+  {
+    pool.release(blocks[i]);
+  }
+  size_t left = liveSamples(pool);
+  check((left > 0) && (left < live), "released samples dropped");
+  pool.setSampleRate(0);
+  blocks = std::vector<void *>(blocks.begin() + 1, blocks.end());
+  for (size_t i = 0; i < blocks.size(); i += 2)
+  {
+    pool.release(blocks[i]);
+  }
+  check(0 == liveSamples(pool), "every sample dropped once released");
+  blocks = allocateSome(pool);
+  check(0 == liveSamples(pool), "nothing sampled once disabled");
+  pool.releaseBulk(blocks.data(), blocks.size());
+
+  // Bulk allocations are sampled block by block like single ones
+  pool.setSampleRate(RATE);
+  size_t got = pool.allocateBulk(BLOCK_SIZE, N_BLOCKS, blocks.data());
+  live = liveSamples(pool);
+  std::cout << "    " << live << " bulk samples, " << expected << " expected"
+            << std::endl;
+  check((N_BLOCKS == got) && (live > expected / 2) && (live < expected * 2),
+      "bulk allocations sampled");
+  pool.releaseBulk(blocks.data(), got);
+  check(0 == liveSamples(pool), "bulk samples dropped");
+
+  // Threads sample and release concurrently
+  pool.setSampleRate(256);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < N_THREADS; ++t)
+  {
+    threads.emplace_back(worker, &pool);
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  check(0 == liveSamples(pool), "concurrent samples all dropped");
+
+  return !s_pass;
+}
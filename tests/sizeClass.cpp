@@ -0,0 +1,71 @@
+#include <iostream>
+#include <vector>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+bool initializes(size_t size)
+{
+  PoolConfig config;
+  config.blockSizes = &size;
+  config.nSizes = 1;
+  MemoryPool pool(config);
+  return pool.isInitialized();
+}
+
+bool aligned(void *p, size_t alignment)
+{
+  return p && (0 == (reinterpret_cast<uintptr_t>(p) % alignment));
+}
+
+int main()
+{
+  check(initializes(48) && initializes(80) && initializes(2560),
+      "quarter step sizes accepted");
+  check(!initializes(24) && !initializes(40) && !initializes(100),
+      "sizes off the grid or under 16 byte aligned rejected");
+
+  size_t sizes[6] = {4096, 48, 2560, 64, 96, 80};
+  size_t counts[6] = {2, 4, 2, 4, 4, 4};
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 6;
+  config.blockCounts = counts;
+  MemoryPool pool(config);
+  check(pool.isInitialized(), "pool with quarter step sizes initialized");
+  pool.setCacheDepth(0);
+
+  // A 2049 byte request lands in a 2560 byte block rather than 4096
+  std::vector<void *> b;
+  bool ok = true;
+  for (size_t n : {2049, 2560, 4000, 4096})
+  {
+    b.emplace_back(pool.allocate(n));
+    ok = ok && aligned(b.back(), 512);
+  }
+  check(ok && !pool.allocate(2049), "requests served from the closest class");
+
+  // Blocks of sizes that are not a power of 2 keep their natural alignment
+  for (size_t n : {33, 48, 65, 80, 81, 96})
+  {
+    for (size_t i = 0; i < 2; ++i)
+    {
+      b.emplace_back(pool.allocate(n));
+      ok = ok && aligned(b.back(), (n > 80) ? 32 : 16);
+    }
+  }
+  check(ok, "blocks aligned");
+
+  // Every block goes back to the allocator it came from
+  for (auto p : b)
+  {
+    pool.release(p);
+  }
+  size_t count = 0;
+  while (pool.allocate(8))
+  {
+    ++count;
+  }
+  check(20 == count, "all blocks released");
+
+  return !s_pass;
+}
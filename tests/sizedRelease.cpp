@@ -0,0 +1,39 @@
+#include <iostream>
+#include "MemoryPool.hpp"
+#include "check.h"
+
+int main()
+{
+  size_t sizes[2] = {64, 256};
+  size_t counts[2] = {2, 2};
+  PoolConfig config;
+  config.blockSizes = sizes;
+  config.nSizes = 2;
+  config.blockCounts = counts;
+  MemoryPool pool(config);
+  pool.setCacheDepth(0);
+
+  // Two blocks of 64 bytes, then a third that falls through to 256
+  void *a = pool.allocate(40);
+  void *b = pool.allocate(40);
+  void *c = pool.allocate(40);
+  void *d = pool.allocate(200);
+  check(a && b && c && d && !pool.allocate(200), "pool exhausted");
+
+  // Blocks go back by size, including the one that fell through
+  pool.release(a, 40);
+  pool.release(c, 40);
+  pool.release(d, 200);
+  check(pool.allocate(200) && pool.allocate(200) && !pool.allocate(200),
+      "fallen-through block released by size");
+  check(a == pool.allocate(64), "block released to its size class");
+
+  // Repeated or foreign sized releases are ignored
+  pool.release(b, 40);
+  pool.release(b, 40);
+  pool.release(&config, 40);
+  check(b == pool.allocate(64) && !pool.allocate(64),
+      "double sized release ignored");
+
+  return !s_pass;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include "StaticMemoryPool.hpp"
+#include "check.h"
+
+struct Message
+{
+  uint8_t payload[100];
+};
+
+// Sizes deliberately out of order; 16384 bytes per class
+static StaticMemoryPool<1024, 64, 256, 128> s_pool;
+
+int main()
+{
+  static_assert(decltype(s_pool)::BLOCK_SIZES[0] == 64, "sizes sorted");
+  static_assert(decltype(s_pool)::SLICE_BYTES == 16384, "equal slices");
+
+  // Compile-time class selection: 100 bytes lands in the 128 byte class
+  auto m = s_pool.allocate<sizeof(Message)>();
+  auto r = s_pool.allocate(sizeof(Message));
+  check(m && r && (reinterpret_cast<uint8_t *>(r) -
+                      reinterpret_cast<uint8_t *>(m)) == 128,
+      "compile-time and runtime lookup agree");
+  s_pool.release<sizeof(Message)>(m);
+  s_pool.release(r);
+
+  // Exhaust the 1024 byte class, then fall through from a smaller class
+  size_t count = 0;
+  while (s_pool.allocate<1024>())
+  {
+    ++count;
+  }
+  check(16 == count, "1024 byte class holds 16 blocks");
+
+  count = 0;
+  void *last = nullptr;
+  while (void *p = s_pool.allocate<256>())
+  {
+    last = p;
+    ++count;
+  }
+  check(64 == count, "256 byte class exhausted without falling through");
+
+  void *small = nullptr;
+  count = 0;
+  while (void *p = s_pool.allocate<128>())
+  {
+    small = p;
+    ++count;
+  }
+  check(128 == count, "128 byte class exhausted");
+
+  // Release through the compile-time path, including a fallen-through block
+  while (s_pool.allocate<64>())
+  {
+  }
+  check(nullptr == s_pool.allocate<64>(), "pool exhausted");
+  s_pool.release<64>(small);
+  check(small == s_pool.allocate<64>(), "fallen-through block released");
+  s_pool.release<256>(last);
+  s_pool.release<256>(last);
+  check(last == s_pool.allocate<256>() && !s_pool.allocate<256>(),
+      "double release ignored");
+
+  return !s_pass;
+}
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "MemoryPool.hpp"
+
+static size_t blksz[4] = {64, 128, 256, 512};  // 256, 128, 64, 32 blocks of
+                                               // each
+static constexpr size_t N_THREADS = 4;
+static constexpr size_t N_ROUNDS = 1000;
+
+size_t fillPool(MemoryPool &pool, const size_t n)
+{
+  std::vector<void *> b;
+  void *block = nullptr;
+  do
+  {
+    block = pool.allocate(n);
+    if (block)
+    {
+      b.emplace_back(block);
+    }
+  } while (block);
+  return b.size();
+}
+
+void worker(size_t id)
+{
+  auto &pool = MemoryPool::getPool(blksz, sizeof(blksz) / sizeof(size_t));
+  std::vector<void *> b;
+
+  // Churn through the smallest size class, leaving blocks in this thread's
+  // cache when it exits
+  for (size_t r = 0; r < N_ROUNDS; ++r)
+  {
+    for (size_t i = 0; i < 20; ++i)
+    {
+      auto block = pool.allocate(64);
+      if (block)
+      {
+        *reinterpret_cast<size_t *>(block) = id;
+        b.emplace_back(block);
+      }
+    }
+    for (auto block : b)
+    {
+      pool.release(block);
+    }
+    b.clear();
+  }
+}
+
+int main()
+{
+  auto &pool = MemoryPool::getPool(blksz, sizeof(blksz) / sizeof(size_t));
+  pool.setCacheDepth(8);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < N_THREADS; ++i)
+  {
+    threads.emplace_back(worker, i);
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+
+  // The counters of the exited threads' caches stay with the pool
+  bool pass = true;
+  PoolStats stats = pool.getStats();
+  uint64_t churned = N_THREADS * N_ROUNDS * 20;
+  if ((stats.classes[0].allocations != churned) ||
+      (stats.classes[0].frees != churned) || (stats.classes[0].inUse != 0))
+  {
+    std::cout << " -- FAIL: " << stats.classes[0].allocations
+              << " allocations and " << stats.classes[0].frees
+              << " frees counted, expected " << churned << std::endl;
+    pass = false;
+  }
+  else
+  {
+    std::cout << " -- PASS: allocations and frees of exited threads counted"
+              << std::endl;
+  }
+
+  // Every block cached by the exited threads must be back in the pool
+  size_t expected[4] = {32, 64, 128, 256};
+  size_t request[4] = {512, 256, 128, 64};
+  for (size_t i = 0; i < 4; ++i)
+  {
+    size_t count = fillPool(pool, request[i]);
+    if (count != expected[i])
+    {
+      std::cout << " -- FAIL: " << count << " blocks of size " << request[i]
+                << " available, expected " << expected[i] << std::endl;
+      pass = false;
+    }
+    else
+    {
+      std::cout << " -- PASS: all blocks of size " << request[i]
+                << " returned to pool" << std::endl;
+    }
+  }
+
+  return !pass;
+}